@@ -0,0 +1,27 @@
+#include "Arena.h"
+
+
+Arena::Arena() = default;
+
+std::pmr::memory_resource *Arena::resource() {
+    return &memory_;
+}
+
+void *Arena::allocate(size_t size, size_t align) {
+    return memory_.allocate(size, align);
+}
+
+const std::string *Arena::intern(std::string_view s) {
+    return &*labels_.insert(std::string(s)).first;
+}
+
+const std::shared_ptr<const NumericMatrix> *Arena::keep(std::shared_ptr<const NumericMatrix> m) {
+    kept_.push_back(std::move(m));
+    return &kept_.back();
+}
+
+void Arena::reset() {
+    kept_.clear();
+    labels_.clear();
+    memory_.release();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory_resource>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <deque>
+
+#include "Coordinate.h"
+
+
+//память дерева одного блока: узлы и списки детей выделяются сдвигом указателя,
+//освобождается все сразу (reset или деструктор), деструкторы узлов не вызываются
+class Arena {
+public:
+    Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    std::pmr::memory_resource *resource();
+
+    void *allocate(size_t size, size_t align);
+
+    const std::string *intern(std::string_view s);  //метка узла: одинаковые строки хранятся один раз
+
+    //числа PMATRIX: узел хранит указатель, владеет арена
+    const std::shared_ptr<const NumericMatrix> *keep(std::shared_ptr<const NumericMatrix> m);
+
+    void reset();
+
+private:
+    std::pmr::monotonic_buffer_resource memory_;
+    std::unordered_set<std::string> labels_;                //адреса элементов не меняются при вставке
+    std::deque<std::shared_ptr<const NumericMatrix>> kept_;
+};
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <vector>
+#include <set>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "Cache.h"
+#include "Serialize.h"
+#include "Value.h"
+#include "basic_HM.h"
+#include "Preprocessor.h"
+
+
+static const char magic[8] = {'T', 'E', 'X', 'P', 'P', 'C', '0', '3'};
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+//блокировка файла кэша на время одной операции
+typedef struct FileLock {
+    int fd;
+
+    FileLock(int f, int op) : fd(f) {
+        while (flock(fd, op) == -1 && errno == EINTR) {}
+    }
+
+    ~FileLock() {
+        flock(fd, LOCK_UN);
+    }
+} FileLock;
+
+BlockCache::BlockCache(const std::string& path, size_t capacity) {
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd_ == -1) return;
+    FileLock lock(fd_, LOCK_EX);
+
+    struct stat st{};
+    if (fstat(fd_, &st) == -1) return;
+    Header h{};
+    bool valid = static_cast<size_t>(st.st_size) >= sizeof(Header) &&
+                 pread(fd_, &h, sizeof(h), 0) == sizeof(h) &&
+                 !std::memcmp(h.magic, magic, sizeof(magic)) &&
+                 h.size == static_cast<uint64_t>(st.st_size) && !h.dirty &&
+                 h.slots && !(h.slots & (h.slots - 1)) &&
+                 align8(sizeof(Header)) + h.slots * sizeof(Slot) <= h.used && h.used <= h.size;
+    size_ = valid ? h.size : std::max<size_t>(capacity, 1u << 20);
+    if (!valid && (ftruncate(fd_, 0) == -1 || ftruncate(fd_, size_) == -1)) return;
+
+    void *p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) return;
+    data_ = static_cast<char *>(p);
+    if (!valid) init();
+}
+
+BlockCache::~BlockCache() {
+    if (data_) munmap(data_, size_);
+    if (fd_ != -1) close(fd_);
+}
+
+bool BlockCache::good() const {
+    return data_ != nullptr;
+}
+
+size_t BlockCache::hits() const {
+    return hits_;
+}
+
+size_t BlockCache::misses() const {
+    return misses_;
+}
+
+void BlockCache::count(bool hit) {
+    ++(hit ? hits_ : misses_);
+}
+
+BlockCache::Header *BlockCache::header() const {
+    return reinterpret_cast<Header *>(data_);
+}
+
+BlockCache::Slot *BlockCache::slots() const {
+    return reinterpret_cast<Slot *>(data_ + align8(sizeof(Header)));
+}
+
+size_t BlockCache::data_begin() const {
+    return align8(sizeof(Header)) + header()->slots * sizeof(Slot);
+}
+
+//новый файл: ячеек примерно по одной на 256 байт записей
+void BlockCache::init() {
+    Header *h = header();
+    size_t n = 256;
+    while (n * 2 * (256 + sizeof(Slot)) <= size_) n *= 2;
+    h->size = size_;
+    h->slots = n;
+    h->used = data_begin();
+    h->entries = 0;
+    h->clock = 0;
+    h->dirty = 0;
+    std::memset(slots(), 0, n * sizeof(Slot));
+    std::memcpy(h->magic, magic, sizeof(magic));
+}
+
+const BlockCache::Entry *BlockCache::find(uint64_t key, std::string_view text, uint64_t state, Slot *&slot) const {
+    uint64_t mask = header()->slots - 1;
+    uint64_t used = header()->used;
+    for (uint64_t i = key & mask, k = 0; k <= mask; i = (i + 1) & mask, ++k) {
+        slot = &slots()[i];
+        if (slot->key == 0) break;
+        if (slot->key != key || slot->offset < data_begin() || slot->offset + sizeof(Entry) > used) continue;
+        auto e = reinterpret_cast<const Entry *>(data_ + slot->offset);
+        const char *body = reinterpret_cast<const char *>(e + 1);
+        if (e->key == key && e->state == state && e->text_length == text.size() &&
+            slot->offset + sizeof(Entry) + e->text_length + e->payload_length <= used &&
+            !std::memcmp(body, text.data(), text.size())) {
+            return e;
+        }
+    }
+    return nullptr;
+}
+
+bool BlockCache::lookup(std::string_view text, uint64_t state, std::string& payload) {
+    if (!good()) return false;
+    uint64_t key = fnv1a(text.data(), text.size(), state) | 1;
+    std::lock_guard<std::mutex> guard(mutex_);
+    FileLock lock(fd_, LOCK_SH);
+    Slot *slot;
+    const Entry *e = find(key, text, state, slot);
+    if (!e) return false;
+    payload.assign(reinterpret_cast<const char *>(e + 1) + e->text_length, e->payload_length);
+    //под разделяемой блокировкой счетчики меняются только атомарно
+    __atomic_store_n(&slot->stamp, __atomic_add_fetch(&header()->clock, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    return true;
+}
+
+void BlockCache::store(std::string_view text, uint64_t state, const std::string& payload) {
+    if (!good()) return;
+    uint64_t key = fnv1a(text.data(), text.size(), state) | 1;
+    size_t need = align8(sizeof(Entry) + text.size() + payload.size());
+    if (need > (size_ - data_begin()) / 4) return;     //слишком большая запись
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    FileLock lock(fd_, LOCK_EX);
+    Header *h = header();
+    Slot *slot;
+    if (find(key, text, state, slot)) return;  //другой процесс успел записать то же самое
+    if (h->used + need > size_ || (h->entries + 1) * 2 > h->slots) compact();
+
+    //сначала запись, потом ячейка: упавший процесс оставит только недостижимый мусор
+    Entry e{key, state, text.size(), payload.size()};
+    char *p = data_ + h->used;
+    std::memcpy(p, &e, sizeof(e));
+    std::memcpy(p + sizeof(e), text.data(), text.size());
+    std::memcpy(p + sizeof(e) + text.size(), payload.data(), payload.size());
+    uint64_t offset = h->used;
+    h->used += need;
+
+    uint64_t mask = h->slots - 1;
+    uint64_t i = key & mask;
+    while (slots()[i].key != 0 && slots()[i].key != key) i = (i + 1) & mask;
+    if (slots()[i].key == 0) ++h->entries;
+    slots()[i].offset = offset;
+    slots()[i].stamp = ++h->clock;
+    slots()[i].key = key;
+}
+
+//вытеснение: остаются недавно использованные записи, занимающие не больше половины места
+void BlockCache::compact() {
+    Header *h = header();
+    h->dirty = 1;
+
+    std::vector<Slot> live;
+    for (uint64_t i = 0; i < h->slots; ++i) {
+        if (slots()[i].key != 0) live.push_back(slots()[i]);
+    }
+    std::sort(live.begin(), live.end(), [](const Slot& a, const Slot& b) { return a.stamp > b.stamp; });
+
+    size_t budget = (size_ - data_begin()) / 2;
+    std::string keep;
+    std::vector<Slot> kept;
+    for (auto& s : live) {
+        if (kept.size() * 4 >= h->slots) break;
+        if (s.offset < data_begin() || s.offset + sizeof(Entry) > h->used) continue;
+        auto e = reinterpret_cast<const Entry *>(data_ + s.offset);
+        size_t len = align8(sizeof(Entry) + e->text_length + e->payload_length);
+        if (s.offset + len > h->used) continue;
+        if (keep.size() + len > budget) break;
+        kept.push_back({s.key, data_begin() + keep.size(), s.stamp});
+        keep.append(data_ + s.offset, len);
+    }
+
+    std::memset(slots(), 0, h->slots * sizeof(Slot));
+    std::memcpy(data_ + data_begin(), keep.data(), keep.size());
+    uint64_t mask = h->slots - 1;
+    for (auto& s : kept) {
+        uint64_t i = s.key & mask;
+        while (slots()[i].key != 0) i = (i + 1) & mask;
+        slots()[i] = s;
+    }
+    h->used = data_begin() + keep.size();
+    h->entries = kept.size();
+    h->dirty = 0;
+}
+
+
+void save_state(const StateSink& sink) {
+    std::string name, value;
+    Node::global.each([&](const std::string& n, const Value& v) {
+        name.assign("g").append(n);
+        value.clear();
+        v.save(value);
+        sink(name, value);
+    });
+    save_analysis(sink);
+}
+
+void load_state(const StateImage& image) {
+    Node::global.clear();
+    for (auto it = image.lower_bound("g"); it != image.end() && it->first[0] == 'g'; ++it) {
+        Reader in(it->second.data(), it->second.size());
+        Node::global[GlobalTable::slot(it->first.substr(1))] = Value::load(in);
+    }
+    load_analysis(image);
+}
+
+static uint64_t entry_hash(const std::string& name, const std::string& value) {
+    return fnv1a(value.data(), value.size(), fnv1a(name.data(), name.size() + 1));
+}
+
+
+CachedEval::CachedEval(BlockCache *cache) : cache_(cache) {}
+
+//приведение state_ к состоянию интерпретатора; сериализуется все, но память
+//выделяется только под изменившиеся записи
+void CachedEval::capture(std::string *changed, uint64_t &n_changed, std::string *removed, uint64_t &n_removed) {
+    size_t seen = 0;
+    save_state([&](const std::string& name, const std::string& value) {
+        ++seen;
+        auto it = state_.find(name);
+        if (it != state_.end()) {
+            if (it->second == value) return;
+            state_hash_ -= entry_hash(it->first, it->second);
+            it->second = value;
+        } else {
+            it = state_.emplace(name, value).first;
+        }
+        state_hash_ += entry_hash(it->first, it->second);
+        if (changed) {
+            put_str(*changed, name);
+            put_str(*changed, value);
+        }
+        ++n_changed;
+    });
+    if (seen == state_.size()) return;
+
+    std::set<std::string> live;     //удаленные записи (в интерпретаторе их не бывает, но формат это допускает)
+    save_state([&](const std::string& name, const std::string&) { live.insert(name); });
+    for (auto it = state_.begin(); it != state_.end();) {
+        if (live.count(it->first)) {
+            ++it;
+            continue;
+        }
+        if (removed) put_str(*removed, it->first);
+        ++n_removed;
+        state_hash_ -= entry_hash(it->first, it->second);
+        it = state_.erase(it);
+    }
+}
+
+//запись кэша: привязка - смещение блока + 1 (0 - нет), замена, измененные и удаленные записи состояния
+std::string CachedEval::eval(const ProgramString& ps, const std::function<std::string()>& run) {
+    if (!cache_ || !cache_->good()) return run();
+
+    if (!valid_) {
+        uint64_t n_changed = 0, n_removed = 0;
+        capture(nullptr, n_changed, nullptr, n_removed);
+        valid_ = true;
+        pending_ = false;
+    }
+
+    std::string payload;
+    if (cache_->lookup(ps.program, state_hash_, payload)) {
+        try {
+            Reader in(payload.data(), payload.size());
+            uint64_t anchor = in.u64();
+            if (anchor == 0 || anchor == ps.offset + 1) {
+                std::string replacement = in.str();
+                std::vector<std::pair<std::string, std::string>> changed;
+                for (uint64_t n = in.u64(); n > 0; --n) {
+                    std::string name = in.str();
+                    changed.emplace_back(std::move(name), in.str());
+                }
+                std::vector<std::string> removed;
+                for (uint64_t n = in.u64(); n > 0; --n) {
+                    removed.push_back(in.str());
+                }
+                for (auto& it : changed) {
+                    auto old = state_.find(it.first);
+                    if (old != state_.end()) state_hash_ -= entry_hash(old->first, old->second);
+                    state_hash_ += entry_hash(it.first, it.second);
+                    state_[it.first] = std::move(it.second);
+                }
+                for (auto& name : removed) {
+                    auto old = state_.find(name);
+                    if (old == state_.end()) continue;
+                    state_hash_ -= entry_hash(old->first, old->second);
+                    state_.erase(old);
+                }
+                pending_ = true;
+                cache_->count(true);
+                return replacement;
+            }
+        }
+        catch (std::runtime_error&) {}
+    }
+    cache_->count(false);
+
+    if (pending_) {
+        load_state(state_);
+        pending_ = false;
+    }
+    uint64_t incoming = state_hash_;
+    valid_ = false;
+    std::string replacement = run();
+
+    std::string changed, removed;
+    uint64_t n_changed = 0, n_removed = 0;
+    capture(&changed, n_changed, &removed, n_removed);
+    valid_ = true;
+
+    payload.clear();
+    put_u64(payload, defines_function(ps) ? ps.offset + 1 : 0);
+    put_str(payload, replacement);
+    put_u64(payload, n_changed);
+    payload += changed;
+    put_u64(payload, n_removed);
+    payload += removed;
+    cache_->store(ps.program, incoming, payload);
+    return replacement;
+}
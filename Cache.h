@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <atomic>
+
+#include "Coordinate.h"
+#include "Serialize.h"
+
+
+//кэш исполненных блоков в отображенном в память файле.
+//ключ - хэш текста блока и хэш входного состояния (Node::global и состояние анализатора),
+//значение - текст замены и выходное состояние. Файл могут одновременно использовать
+//несколько процессов (flock) и несколько потоков (mutex); размер файла постоянный,
+//при нехватке места вытесняются давно не использованные записи
+class BlockCache {
+public:
+    BlockCache(const std::string& path, size_t capacity);
+
+    ~BlockCache();
+
+    bool good() const;
+
+    bool lookup(std::string_view text, uint64_t state, std::string& payload);
+
+    void count(bool hit);
+
+    void store(std::string_view text, uint64_t state, const std::string& payload);
+
+    size_t hits() const;
+
+    size_t misses() const;
+
+    BlockCache(BlockCache const&) = delete;
+    BlockCache& operator=(BlockCache const&) = delete;
+
+private:
+    typedef struct Header {
+        char magic[8];
+        uint64_t size;          //размер файла
+        uint64_t slots;         //число ячеек хэш-таблицы, степень двойки
+        uint64_t used;          //конец занятой части области записей
+        uint64_t entries;
+        uint64_t clock;         //счетчик обращений для LRU
+        uint64_t dirty;         //1 во время уплотнения: если процесс упал, файл переинициализируется
+    } Header;
+
+    typedef struct Slot {
+        uint64_t key;           //0 - свободная ячейка
+        uint64_t offset;
+        uint64_t stamp;
+    } Slot;
+
+    typedef struct Entry {
+        uint64_t key;
+        uint64_t state;
+        uint64_t text_length;
+        uint64_t payload_length;
+    } Entry;
+
+    int fd_ = -1;
+    char *data_ = nullptr;
+    size_t size_ = 0;
+    std::mutex mutex_;         //flock общий для всех потоков процесса
+    std::atomic<size_t> hits_{0};
+    std::atomic<size_t> misses_{0};
+
+    Header *header() const;
+
+    Slot *slots() const;
+
+    size_t data_begin() const;
+
+    void init();
+
+    const Entry *find(uint64_t key, std::string_view text, uint64_t state, Slot *&slot) const;
+
+    void compact();
+};
+
+//состояние интерпретатора по записи на имя: g - Node::global, остальное - анализатор.
+//в кэше хранятся только изменившиеся записи, хэш состояния - сумма хэшей записей
+typedef std::map<std::string, std::string> StateImage;
+
+void save_state(const StateSink& sink);
+
+void load_state(const StateImage& image);
+
+//исполнение блоков документа через кэш: Node::global восстанавливается
+//из кэша только тогда, когда очередной блок все-таки приходится исполнять
+class CachedEval {
+public:
+    explicit CachedEval(BlockCache *cache);
+
+    std::string eval(const ProgramString& ps, const std::function<std::string()>& run);
+
+private:
+    BlockCache *cache_;
+    StateImage state_;          //входное состояние очередного блока
+    uint64_t state_hash_ = 0;
+    bool valid_ = false;        //state_ соответствует состоянию интерпретатора
+    bool pending_ = false;      //состояние интерпретатора еще надо загрузить из state_
+
+    void capture(std::string *changed, uint64_t &n_changed, std::string *removed, uint64_t &n_removed);
+};
@@ -1,25 +1,16 @@
 #include <string>
 #include <iostream>
 #include <utility>
+#include <algorithm>
+#include <cstring>
 #include "Coordinate.h"
 
 
 Coordinate::Coordinate(size_t l, size_t p) : line(l), pos(p) {}
 
-Coordinate& Coordinate::inc_line() {
-    line++;
-    pos = 1;
-    return *this;
-}
+Coordinate::Coordinate(const Coordinate &c) noexcept : line(c.line), pos(c.pos) {}
 
-Coordinate& Coordinate::inc_pos() {
-    pos++;
-    return *this;
-}
-
-Coordinate::Coordinate(const Coordinate &c) : line(c.line), pos(c.pos) {}
-
-Coordinate& Coordinate::operator=(const Coordinate &c) {
+Coordinate& Coordinate::operator=(const Coordinate &c) noexcept {
     if (&c != this) {
         line = c.line;
         pos = c.pos;
@@ -36,23 +27,44 @@ bool Coordinate::operator<(const Coordinate &other) const {
 }
 
 
-Position::Position(const Position &p) : start(p.start), index(p.index) {}
+void LineIndex::reset(std::string_view text, size_t first) {
+    data = text.data();
+    size = text.size();
+    first_line = first;
+    newlines.clear();
+    scanned = 0;
+}
 
-Position::Position(const Coordinate& x, size_t i) : start(x), index(i) {
-    if (ps.end < start) {
-        std::cout << "Position:: ps.end < start\n";
-        throw std::exception();
+size_t LineIndex::line(size_t offset) {
+    if (offset > size) offset = size;
+    while (scanned < offset) {  //достроить индекс до offset
+        auto nl = static_cast<const char *>(std::memchr(data + scanned, '\n', size - scanned));
+        if (!nl) {
+            scanned = size;
+            break;
+        }
+        newlines.push_back(nl - data);
+        scanned = nl - data + 1;
     }
+    return std::lower_bound(newlines.begin(), newlines.end(), offset) - newlines.begin() + first_line;
 }
 
-Position& Position::operator=(const Position &p) {
-    if (&p != this) {
-        start = p.start;
-        index = p.index;
-    }
-    return *this;
+Coordinate LineIndex::coordinate(size_t offset) {
+    size_t l = line(offset);
+    size_t k = l - first_line;  //переводов строк до offset в newlines
+    size_t line_start = (k == 0) ? 0 : newlines[k - 1] + 1;
+    return {l, offset - line_start + 1};
 }
 
+void ProgramString::assign(std::string text) {
+    storage = std::make_shared<const std::string>(std::move(text));
+    program = *storage;
+    length = program.length();
+}
+
+
+Position::Position(size_t i) : index(i) {}
+
 Position Position::operator++(int) {
     Position tmp(*this);
     operator++();
@@ -63,10 +75,6 @@ char Position::operator[](int i) const {
     return ps.program[i];
 }
 
-char& Position::operator[](int i) {
-    return ps.program[i];
-}
-
 char Position::cur() {
     return ps.program[index];
 }
@@ -85,66 +93,98 @@ char Position::get() {
     return res;
 }
 
-bool Position::operator<(const Position &p) const {
-    return start < p.start;
-}
-
-bool Position::operator==(const Position &p) const {
-    return start == p.start;
+size_t Position::offset() const {
+    return ps.offset + index;
 }
 
 bool Position::end_of_program() const {
-    return start == ps.end;
-}
-
-int Position::is_at_newline() {
-    if (cur() == '\n') return cur_type::NLINE;
-    if (index + 1 < ps.length &&
-        cur() == '\r' && peek() == '\n') {
-        return cur_type::WNLINE;
-    }
-    return cur_type::CHAR;
+    return index >= ps.last;
 }
 
+//перевод строки \r\n - один шаг, чтобы комментарий % не обрывался на \r
 Position &Position::operator++() {
     if (!end_of_program()) {
-        int at_newline = is_at_newline();
-        if (at_newline == CHAR) {
-            start.inc_pos();
-            ++index;
-        } else {
-            start.inc_line();
-            index += at_newline;
-        }
+        index += (ps.program[index] == '\r' && index + 1 < ps.length && ps.program[index + 1] == '\n') ? 2 : 1;
     }
+    return *this;
+}
 
+Position &Position::advance(size_t i) {
+    index = i;
     return *this;
 }
 
 
-Token::Token(const Token &t) : start(t.start), end(t.end), raw(t.raw), _ident(t._ident), _tag(t._tag) {}
+Symbols::Symbols() {
+    clear();
+}
 
-Token::Token(const Position& s, const Position& e, Tag t, std::string r)
-        : start(s), end(e), _tag(t), raw(std::move(r)) {
-    _ident = t_info[_tag].name;
+void Symbols::clear() {
+    names.assign(1, std::string_view());
+    slots.assign(64, 0);
+    owned.clear();
 }
 
-Token& Token::operator=(const Token &t) {
-    if (&t != this) {
-        start = t.start;
-        end = t.end;
-        raw = t.raw;
-        _ident = t._ident;
-        _tag = t._tag;
+static uint32_t symbol_hash(std::string_view s) {
+    uint32_t h = 2166136261u;
+    for (char c : s) h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+    return h;
+}
+
+uint32_t Symbols::intern(std::string_view s) {
+    if (s.empty()) return 0;
+    if (names.size() * 2 >= slots.size()) {     //заполнено наполовину - перестроить вдвое больше
+        std::vector<uint32_t> bigger(slots.size() * 2, 0);
+        for (uint32_t id = 1; id < names.size(); ++id) {
+            size_t k = symbol_hash(names[id]) & (bigger.size() - 1);
+            while (bigger[k]) k = (k + 1) & (bigger.size() - 1);
+            bigger[k] = id;
+        }
+        slots.swap(bigger);
     }
-    return *this;
+    size_t k = symbol_hash(s) & (slots.size() - 1);
+    for (; slots[k]; k = (k + 1) & (slots.size() - 1)) {
+        if (names[slots[k]] == s) return slots[k];
+    }
+    slots[k] = static_cast<uint32_t>(names.size());
+    names.push_back(s);
+    return slots[k];
+}
+
+std::string_view Symbols::keep(const std::string& s) {
+    owned.push_back(s);
+    return owned.back();
+}
+
+std::string_view Symbols::operator[](uint32_t id) const {
+    return names[id];
+}
+
+
+Token::Token(const Position& s, const Position& e, Tag t, std::string_view r)
+        : offset(static_cast<uint32_t>(s.index)), length(static_cast<uint32_t>(e.index - s.index)),
+          symbol(symbols.intern(r)), _tag(t) {}
+
+std::string_view Token::raw() const {
+    return symbols[symbol];
+}
+
+const char *Token::name() const {
+    return t_info[_tag].name;
+}
+
+size_t Token::at() const {
+    return Position::ps.offset + offset;
+}
+
+size_t Token::end() const {
+    return offset + length;
 }
 
 void Token::convert() {
     Tag alt = t_info[_tag].alternative_tag;
     if (alt) {
         _tag = alt;
-        _ident = t_info[_tag].name;
     }
 }
 
@@ -156,30 +196,19 @@ void Token::binary() {
     if (!t_info[_tag].is_binary) convert();
 }
 
-bool Token::operator<(const Token &t) const {
-    return start < t.start;
-}
-
-bool Token::operator==(const Token &t) const {
-    return start == t.start;
-}
-
 
 std::string to_string(const Coordinate& c) {
     return "(" + std::to_string(c.line) + ", " + std::to_string(c.pos) + ")";
 }
 
 std::string to_string(const ProgramString& ps) {
-    return "ProgramString " + to_string(ps.begin) + "-" + to_string(ps.end) +
-           " (" + std::to_string(ps.length) + ")\n" + ps.program;
-}
-
-std::string to_string(const Position& p) {
-    return "{" + to_string(p.start) + ", " + std::to_string(p.index) + "}";
+    return "ProgramString " + std::to_string(ps.first) + "-" + std::to_string(ps.last) +
+           " (" + std::to_string(ps.length) + ")\n" + std::string(ps.program);
 }
 
 std::string to_string(const Token& l) {
-    std::string res = "<" + to_string(l.start) + "-" + to_string(l.end) +
-                      ": " + ((l.raw.empty()) ? "" : (l.raw + "; ")) + l._ident + ">";
+    std::string res = "<" + to_string(Position::lines.coordinate(l.at())) + "-" +
+                      to_string(Position::lines.coordinate(Position::ps.offset + l.end())) +
+                      ": " + ((l.raw().empty()) ? "" : (std::string(l.raw()) + "; ")) + l.name() + ">";
     return res;
 }
\ No newline at end of file
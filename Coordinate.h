@@ -1,23 +1,25 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <memory>
 #include <iostream>
 #include <utility>
+#include <vector>
+#include <deque>
+#include <cstdint>
 #include "Defines.h"
 
 
+//строка и позиция в ней - только для сообщений: в токенах, деревьях и заменах хранятся смещения
 typedef struct Coordinate {
     size_t line, pos;   //строка, смещение
 
     Coordinate(size_t = 1, size_t = 1);
 
-    Coordinate &inc_line();
+    Coordinate(const Coordinate &c) noexcept;
 
-    Coordinate &inc_pos();
-
-    Coordinate(const Coordinate &c);
-
-    Coordinate &operator=(const Coordinate &c);
+    Coordinate &operator=(const Coordinate &c) noexcept;
 
     bool operator==(const Coordinate &other) const;
 
@@ -26,36 +28,48 @@ typedef struct Coordinate {
     friend std::string to_string(const Coordinate& c);
 } Coordinate;
 
+//индекс переводов строк входного файла: строится по запросу, то есть только когда нужно сообщение
+typedef struct LineIndex {
+    const char *data = nullptr;
+    size_t size = 0;
+    size_t first_line = 1;          //номер строки смещения 0
+    std::vector<size_t> newlines;   //смещения символов '\n'
+    size_t scanned = 0;             //до какого смещения индекс уже построен
+
+    void reset(std::string_view text, size_t first = 1);
+
+    size_t line(size_t offset);
+
+    Coordinate coordinate(size_t offset);
+} LineIndex;
+
+//текст блока - срез отображенного входного файла (потоковый режим)
+//или собственная копия в storage, общая для копий ProgramString
 typedef struct ProgramString {
-    std::string program;
-    Coordinate begin;
-    Coordinate end;
+    std::string_view program;
+    std::shared_ptr<const std::string> storage;
+    size_t first = 0;   //индекс в program: код после \begin{preproc}
+    size_t last = 0;    //индекс в program: \end{preproc} (или конец текста)
     size_t length = 0;
+    size_t offset = 0;  //смещение начала программы во входном файле
+
+    void assign(std::string text);  //сохранить копию текста, length тоже обновляется
 } ProgramString;
 
 typedef struct Position {
-    Coordinate start;
     size_t index;
-    static ProgramString ps;
-    enum cur_type {
-        CHAR, NLINE, WNLINE
-    };
+    static thread_local ProgramString ps;
+    static thread_local LineIndex lines;    //строки входного файла, который обрабатывает поток
 
-    Position(const Position &p);
-
-    Position(const Coordinate& = Coordinate(), size_t = 0);
-
-    Position &operator=(const Position &p);
-
-    int is_at_newline();
+    Position(size_t = 0);
 
     Position &operator++();
 
     Position operator++(int);
 
-    char operator[](int i) const;
+    Position &advance(size_t i);    //перейти вперед на индекс i
 
-    char &operator[](int i);
+    char operator[](int i) const;
 
     char cur();
 
@@ -65,47 +79,70 @@ typedef struct Position {
 
     char get();
 
-    bool operator<(const Position &p) const;
-
-    bool operator==(const Position &p) const;
-
-    friend std::string to_string(const Position& p);
+    size_t offset() const;          //смещение во входном файле
 
     bool end_of_program() const;
 } Position;
 
 
+//тексты токенов блока: id -> строка, одинаковые строки получают один id.
+//срезы текста блока не копируются, остальные имена (x_\text{...}, константы лексера) хранятся здесь
+typedef struct Symbols {
+    std::vector<std::string_view> names;    //id 0 - пустая строка
+    std::vector<uint32_t> slots;            //открытая адресация по хешу, 0 - свободно
+    std::deque<std::string> owned;
+
+    Symbols();
+
+    void clear();   //новый блок: старые id и сохраненные имена больше не нужны
+
+    uint32_t intern(std::string_view s);    //s должна жить до clear()
+
+    std::string_view keep(const std::string& s);    //сохранить копию до clear()
+
+    std::string_view operator[](uint32_t id) const;
+} Symbols;
+
+//16 байт: тег, диапазон в тексте блока и id текста; координаты вычисляются по смещению
 typedef struct Token {
-    Position start; //координаты начала и конца
-    Position end;
-    std::string raw;    //подстрока из файла
-    std::string _ident;    //строковое представление тега - для принта
+    uint32_t offset = 0;    //начало в тексте блока
+    uint32_t length = 0;
+    uint32_t symbol = 0;    //текст токена в symbols, 0 - без текста
     Tag _tag = ERROR;
 
-    Token(const Token &t);
+    static thread_local Symbols symbols;
+
+    Token() = default;
 
-    Token(const Position&, const Position&, Tag = ERROR, std::string = "");
+    Token(const Position&, const Position&, Tag = ERROR, std::string_view = {});
 
-    Token &operator=(const Token &t);
+    std::string_view raw() const;
+
+    const char *name() const;       //строковое представление тега - для принта
+
+    size_t at() const;              //смещение начала во входном файле
+
+    size_t end() const;             //индекс за концом токена
 
     void convert();
 
     void unary();
 
     void binary();
+} Token;
 
-    bool operator<(const Token &t) const;
-
-    bool operator==(const Token &t) const;
+static_assert(sizeof(Token) == 16, "Token should stay compact");
 
-    friend std::string to_string(const Position& p);
-} Token;
+//pmatrix из одних чисел: элементы по строкам в одном буфере
+typedef struct NumericMatrix {
+    size_t rows = 0;
+    size_t cols = 0;
+    std::vector<double> data;
+} NumericMatrix;
 
 
 std::string to_string(const Coordinate& c);
 
 std::string to_string(const ProgramString& ps);
 
-std::string to_string(const Position& p);
-
 std::string to_string(const Token& l);
\ No newline at end of file
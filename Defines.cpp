@@ -1,4 +1,3 @@
-#include <map>
 #include <cmath>
 #include <utility>
 #include <array>
@@ -6,26 +5,22 @@
 #include "Defines.h"
 
 
-Tag_info::Tag_info(
-    std::string n,
-    int p,
-    Tag ct,
-    Tag at,
-    bool op,
-    bool bin,
-    bool inv
-) :
-name(std::move(n)),
-priority(p),
-close_tag(ct),
-alternative_tag(at),
-is_operator(op),
-is_binary(bin),
-is_inverted(inv)
-{}
+//повторный тег в списке не меняет таблицу, как было с std::map: действует первое описание
+static constexpr std::array<Tag_info, PMATRIX + 1> make_t_info(std::initializer_list<std::pair<Tag, Tag_info>> list) {
+    std::array<Tag_info, PMATRIX + 1> res;
+    std::array<bool, PMATRIX + 1> seen{};
+    for (auto& it : list) {
+        if (!seen[it.first]) res[it.first] = it.second;
+        seen[it.first] = true;
+    }
+    for (bool s : seen) {
+        if (!s) throw "every tag must be in t_info";
+    }
+    return res;
+}
 
-
-std::map<Tag, Tag_info> t_info = {
+constexpr std::array<Tag_info, PMATRIX + 1> t_info = make_t_info({
+        {NONE,        Tag_info("NONE", 0, NONE, NONE)},
 
         //простые элементы
         {NUMBER,      Tag_info("NUMBER", 0, NONE, NONE)},
@@ -85,7 +80,6 @@ std::map<Tag, Tag_info> t_info = {
 
         {IF,          Tag_info("IF", 0, NONE, NONE)},
         {WHILE,       Tag_info("WHILE", 0, NONE, NONE)},
-        {PRODUCT,     Tag_info("PRODUCT", 0, NONE, NONE)},
         {ELSE,        Tag_info("ELSE", 0, NONE, NONE)},
         {WHEN,        Tag_info("WHEN", 0, NONE, NONE)},
         {OTHERWISE,   Tag_info("OTHERWISE", 0, NONE, NONE)},
@@ -101,13 +95,18 @@ std::map<Tag, Tag_info> t_info = {
         {RANGE,       Tag_info("RANGE", 0, NONE, NONE)},
         {TRANSP,      Tag_info("TRANSP", 0, NONE, NONE)},
 
-        {SUM,         Tag_info("SUM", 0, NONE, NONE)},
-        {PRODUCT,     Tag_info("PRODUCT", 0, NONE, NONE)},
-        {DIMENSION, Tag_info("DIMENSION", 0, NONE, NONE)}
-};
+        {SUM,         Tag_info("SUM", 0, ENDSUM, NONE)},      //тело - до конца строки
+        {PRODUCT,     Tag_info("PRODUCT", 0, ENDSUM, NONE)},
+        {ENDSUM,      Tag_info("ENDSUM", 0, NONE, NONE)},
+        {PMATRIX,     Tag_info("PMATRIX", 0, NONE, NONE)},    //числовая pmatrix целиком, числа разобраны лексером
+        {DIMENSION, Tag_info("DIMENSION", 0, NONE, NONE)},
+        {SKIP,        Tag_info("SKIP", 0, NONE, NONE)},
+        {FLOOR,       Tag_info("FLOOR", 0, NONE, NONE)},
+        {CEIL,        Tag_info("CEIL", 0, NONE, NONE)}
+});
 
 
-std::map<std::string, enum Tag> raw_tag = {
+constexpr Keyword_table<enum Tag, 64> raw_tag = {
         {"\\\\",          Tag::BREAK},
         {"\\begin",       Tag::BEGIN},
         {"\\end",         Tag::END},
@@ -139,94 +138,57 @@ std::map<std::string, enum Tag> raw_tag = {
         {"\\ceil",       Tag::CEIL}
 };
 
-std::map<std::string, enum Tag> dim_tag = {
-        {"m", Tag::DIMENSION},
-        {"kg", Tag::DIMENSION},
-        {"s", Tag::DIMENSION},
-        {"A", Tag::DIMENSION},
-        {"K", Tag::DIMENSION},
-        {"mol", Tag::DIMENSION},
-        {"cd", Tag::DIMENSION},
-};
-
 /**
  * m, kg, s, A, K, mol, cd
  */
-std::map<std::string, std::array<int, 7>> const dimensions = {
+constexpr Keyword_table<std::array<int, 7>, 16> dimensions = {
         //метры
-        {"m",   {1, 0, 0, 0, 0, 0, 0}},
+        {"m",   {{1, 0, 0, 0, 0, 0, 0}}},
 
         //килограммы
-        {"kg",  {0, 1, 0, 0, 0, 0, 0}},
+        {"kg",  {{0, 1, 0, 0, 0, 0, 0}}},
 
         //секунды
-        {"s",   {0, 0, 1, 0, 0, 0, 0}},
+        {"s",   {{0, 0, 1, 0, 0, 0, 0}}},
 
         //амперы
-        {"A",   {0, 0, 0, 1, 0, 0, 0}},
+        {"A",   {{0, 0, 0, 1, 0, 0, 0}}},
 
         //кельвины
-        {"K",   {0, 0, 0, 0, 1, 0, 0}},
+        {"K",   {{0, 0, 0, 0, 1, 0, 0}}},
 
         //моли
-        {"mol", {0, 0, 0, 0, 0, 1, 0}},
+        {"mol", {{0, 0, 0, 0, 0, 1, 0}}},
 
         //канделы
-        {"cd",  {0, 0, 0, 0, 0, 0, 1}},
+        {"cd",  {{0, 0, 0, 0, 0, 0, 1}}},
 
 };
 
-std::map<std::string, int> arg_count = {
-        {"\\cos",    1},
-        {"\\sin",    1},
-        {"\\tan",    1},
-        {"\\cot",    1},
-        //        { "\\exp", 1 },
-        {"\\ln",     1},
-        //        { "\\sqrt", 1 },
-        //        {"\\pow", 2},
-
-        {"\\arcsin", 1},
-        {"\\arccos", 1},
-        {"\\arctan", 1},
-        //  { "\\arccot", 1 },
-        {"\\cosh",   1},
-        {"\\sinh",   1},
-        {"\\tanh",   1},
-        //  { "\\coth", 1 },
-        //  { "\\sec", 1 },
-        //  { "\\csc", 1 },
-        {"\\floor",  1},
-        {"\\ceil",  1}
-};
-
-std::map<std::string, double> constants = {
-        {"\\true",  1},
-        {"\\false", 0},
-        {"\\pi",    3.14159265358979323846},
-        {"\\exp",   exp(1)}
-};
-
-std::map<std::string, double (*)(double)> funcs1 = {
-        {"\\cos",    cos},
-        {"\\sin",    sin},
-        {"\\tan",    tan},
-        {"\\cot",    [](double x) { return 1 / tan(x); }},
+//константы (argc == 0) и функции; funcs2 пока пуст
+constexpr Keyword_table<Builtin, 64> builtins = {
+        {"\\true",   {0, 1}},
+        {"\\false",  {0, 0}},
+        {"\\pi",     {0, 3.14159265358979323846}},
+        {"\\exp",    {0, 2.71828182845904523536}},
+
+        {"\\cos",    {1, 0, cos}},
+        {"\\sin",    {1, 0, sin}},
+        {"\\tan",    {1, 0, tan}},
+        {"\\cot",    {1, 0, [](double x) { return 1 / tan(x); }}},
         //   { "\\exp", exp },
-        {"\\ln",     log},
+        {"\\ln",     {1, 0, log}},
         //   { "\\sqrt", sqrt },
-        {"\\arcsin", asin},
-        {"\\arccos", acos},
-        {"\\arctan", atan},
+        {"\\arcsin", {1, 0, asin}},
+        {"\\arccos", {1, 0, acos}},
+        {"\\arctan", {1, 0, atan}},
         //  { "\\arccot", 1 },
-        {"\\cosh",   cosh},
-        {"\\sinh",   sinh},
-        {"\\tanh",   tanh},
+        {"\\cosh",   {1, 0, cosh}},
+        {"\\sinh",   {1, 0, sinh}},
+        {"\\tanh",   {1, 0, tanh}},
         //  { "\\coth", 1 },
         //  { "\\sec", 1 },
         //  { "\\csc", 1 },
-        {"\\floor",  floor},
-        {"\\ceil",  ceil}
+        {"\\floor",  {1, 0, floor, nullptr, true}},
+        {"\\ceil",   {1, 0, ceil}}
 };
-
-std::map<std::string, double (*)(double, double)> funcs2 = {};
@@ -6,6 +6,9 @@
 #include <utility>
 #include <vector>
 #include <array>
+#include <string_view>
+#include <initializer_list>
+#include <cstdint>
 
 
 enum Tag {
@@ -21,11 +24,12 @@ enum Tag {
     NUMBER, IDENT, KEYWORD, FUNC,
     ERROR, SPACE,
     PLACEHOLDER, TEXT, LIST, ROOT,
-    GRAPHIC, RANGE, TRANSP, SUM, PRODUCT, DIMENSION, SKIP, ABS, FLOOR, CEIL
+    GRAPHIC, RANGE, TRANSP, SUM, PRODUCT, DIMENSION, SKIP, ABS, FLOOR, CEIL,
+    ENDSUM, PMATRIX
 };
 
 typedef struct Tag_info {
-    std::string name = "NONE";
+    const char *name = "NONE";
     int priority = 0;
     Tag close_tag = NONE;
     Tag alternative_tag = NONE;
@@ -33,33 +37,87 @@ typedef struct Tag_info {
     bool is_binary = false;
     bool is_inverted = false;
 
-    explicit Tag_info(
-        std::string = "NONE",
-        int = 0,
-        Tag = NONE,
-        Tag = NONE,
-        bool = false,
-        bool = false,
-        bool = false
-    );
+    constexpr explicit Tag_info(
+        const char *n = "NONE",
+        int p = 0,
+        Tag ct = NONE,
+        Tag at = NONE,
+        bool op = false,
+        bool bin = false,
+        bool inv = false
+    ) :
+    name(n),
+    priority(p),
+    close_tag(ct),
+    alternative_tag(at),
+    is_operator(op),
+    is_binary(bin),
+    is_inverted(inv)
+    {}
 } Tag_info;
 
 
-extern std::map<Tag, Tag_info> t_info ;
+//таблица ключевых слов с совершенным хешем: ключи известны при компиляции,
+//конструктор подбирает seed, при котором у ключей нет коллизий в Slots ячейках,
+//поэтому поиск - один хеш и одно сравнение строк
+template <typename T, size_t Slots>
+struct Keyword_table {
+    static_assert((Slots & (Slots - 1)) == 0, "Slots must be a power of two");
 
-extern std::map<std::string, enum Tag> raw_tag;
+    typedef struct Entry {
+        std::string_view key;
+        T value;
+    } Entry;
 
-extern std::map<std::string, enum Tag> dim_tag;
+    Entry slots[Slots] = {};
+    uint32_t seed = 0;
 
-/**
- * m, kg, s, A, K, mol, cd
- */
-extern std::map<std::string, std::array<int, 7>> const dimensions;
+    static constexpr uint32_t hash(std::string_view s, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (char c : s) h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+        return h ^ (h >> 15);
+    }
+
+    constexpr Keyword_table(std::initializer_list<Entry> entries) {
+        for (; seed < 100000; ++seed) {
+            bool ok = true;
+            for (auto& slot : slots) slot = Entry{};
+            for (auto& e : entries) {
+                Entry& slot = slots[hash(e.key, seed) & (Slots - 1)];
+                if (!slot.key.empty()) {
+                    ok = false;
+                    break;
+                }
+                slot = e;
+            }
+            if (ok) return;
+        }
+        throw "no perfect hash seed, increase Slots";   //при вычислении во время компиляции - ошибка сборки
+    }
+
+    constexpr const T *find(std::string_view key) const {
+        const Entry& e = slots[hash(key, seed) & (Slots - 1)];
+        return (!e.key.empty() && e.key == key) ? &e.value : nullptr;
+    }
+};
 
-extern std::map<std::string, int> arg_count;
+//встроенная функция или константа, имя разрешается один раз при построении узла
+typedef struct Builtin {
+    int argc = 0;                       //0 - константа value
+    double value = 0;
+    double (*f1)(double) = nullptr;
+    double (*f2)(double, double) = nullptr;
+    bool any_dimension = false;         //аргумент может быть размерным, размерность переходит в результат
+} Builtin;
 
-extern std::map<std::string, double> constants;
 
-extern std::map<std::string, double (*)(double)> funcs1;
+extern const std::array<Tag_info, PMATRIX + 1> t_info;     //индекс - тег
+
+extern const Keyword_table<enum Tag, 64> raw_tag;
+
+/**
+ * m, kg, s, A, K, mol, cd
+ */
+extern const Keyword_table<std::array<int, 7>, 16> dimensions;
 
-extern std::map<std::string, double (*)(double, double)> funcs2;
+extern const Keyword_table<Builtin, 64> builtins;      //\cos, \pi, ...
@@ -0,0 +1,141 @@
+#include <iostream>
+#include <filesystem>
+
+#include "Document.h"
+#include "FileHandler.h"
+#include "Preprocessor.h"
+#include "basic_HM.h"
+
+
+Document::Document(const std::string& root, size_t jobs, BlockCache *cache) : pool_(jobs), cached_(cache) {
+    namespace fs = std::filesystem;
+    root_ = fs::weakly_canonical(root).string();
+    dir_ = fs::path(root_).parent_path().string();
+}
+
+Document::~Document() = default;
+
+size_t Document::files() const {
+    return evaluated_.size();
+}
+
+//пути в \input разрешаются относительно каталога корневого документа, как это делает TeX
+std::string Document::resolve(const std::string& name) const {
+    namespace fs = std::filesystem;
+    fs::path p(name);
+    if (p.is_relative()) p = fs::path(dir_) / p;
+    for (const fs::path& candidate : {p, fs::path(p.string() + ".tex")}) {
+        std::error_code ec;
+        if (fs::is_regular_file(candidate, ec)) {
+            return fs::weakly_canonical(candidate).string();
+        }
+    }
+    return "";
+}
+
+void Document::discover(const std::string& file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sources_.count(file)) return;
+    sources_[file] = pool_.submit([this, file]() { return parse(file); }).share();
+}
+
+//выполняется в потоке пула: все блоки файла разбираются заранее
+std::shared_ptr<Document::Source> Document::parse(const std::string& file) {
+    auto src = std::make_shared<Source>();
+    FileHandler fh(file.c_str(), nullptr);
+    fh.follow_includes(true);
+    if (!fh.good()) {
+        src->good = false;
+        return src;
+    }
+    Position::lines.reset(fh.text());
+    for (;;) {
+        ProgramString ps = fh.next();
+        if (ps.program.empty()) {
+            if (fh.include().empty()) break;
+            std::string child = resolve(fh.include());
+            if (!child.empty()) discover(child);
+            continue;
+        }
+        src->blocks.emplace_back();
+        Block& b = src->blocks.back();
+        b.ps = std::move(ps);
+        Node::reps.clear();
+        try {
+            b.root = parse_block(b.ps, *b.arena);
+            b.reps = std::move(Node::reps);
+        }
+        catch (...) {
+            b.error = std::current_exception();
+            break;  //исполнение все равно остановится на этом блоке
+        }
+        Node::reps.clear();
+    }
+    return src;
+}
+
+bool Document::evaluate(const std::string& file) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!evaluated_.insert(file).second) return true;   //файл подключается повторно
+    }
+    std::shared_ptr<Source> src = sources_.at(file).get();
+
+    std::string out = temp_name(file);
+    FileHandler fh(file.c_str(), out.c_str());
+    fh.follow_includes(true);
+    if (!fh.good() || !src->good) {
+        std::cerr << file << ":" << "Failed to initialize" << std::endl;
+        fh.remove_out();
+        return false;
+    }
+    Position::lines.reset(fh.text());
+
+    bool ok = true;
+    size_t k = 0;
+    while (ok) {
+        ProgramString ps = fh.next();
+        if (ps.program.empty()) {
+            if (fh.include().empty()) break;
+            std::string child = resolve(fh.include());
+            if (child.empty()) {
+                std::cerr << file << ":" << "Included file not found, skipped: " << fh.include() << std::endl;
+            } else {
+                ok = evaluate(child);
+                Position::lines.reset(fh.text());   //строки снова этого файла
+            }
+            continue;
+        }
+        if (k == src->blocks.size()) break;    //файл изменился между проходами
+        Block& b = src->blocks[k++];
+        ok = run_reported(file.c_str(), [&]() {
+            fh.print_to_out(cached_.eval(b.ps, [&]() {
+                if (b.error) std::rethrow_exception(b.error);
+                Node::reps = std::move(b.reps);
+                return eval_block(b.root, b.ps);
+            }));
+        });
+        b.arena.reset();    //дерево больше не нужно
+        b.root = nullptr;
+    }
+
+    if (ok) {
+        ok = !fh.replace_files();
+    } else {
+        fh.remove_out();
+    }
+    return ok;
+}
+
+bool Document::process() {
+    Node::global.clear();
+    Node::reps.clear();
+    reset_analysis();
+
+    if (resolve(root_).empty()) {
+        std::cerr << root_ << ":" << "Failed to initialize" << std::endl;
+        return false;
+    }
+    discover(root_);
+    return evaluate(root_);
+}
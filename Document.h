@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <exception>
+
+#include "Coordinate.h"
+#include "Node.h"
+#include "ThreadPool.h"
+#include "Cache.h"
+
+
+//документ вместе с файлами, подключенными через \input{...} и \include{...}:
+//лексический и синтаксический анализ файлов идет параллельно,
+//исполнение - последовательно в порядке подключения, Node::global общее для всех файлов
+class Document {
+public:
+    explicit Document(const std::string& root, size_t jobs = 0, BlockCache *cache = nullptr);
+
+    ~Document();
+
+    bool process();
+
+    size_t files() const;   //сколько файлов обработано
+
+private:
+    typedef struct Block {
+        ProgramString ps;
+        std::unique_ptr<Arena> arena = std::make_unique<Arena>();  //дерево блока
+        Node *root = nullptr;
+        replacement_map reps;       //замены, сохраненные парсером
+        std::exception_ptr error;
+    } Block;
+
+    typedef struct Source {
+        std::vector<Block> blocks;
+        bool good = true;
+    } Source;
+
+    std::string root_;
+    std::string dir_;
+    ThreadPool pool_;
+    std::mutex mutex_;
+    std::map<std::string, std::shared_future<std::shared_ptr<Source>>> sources_;
+    std::set<std::string> evaluated_;
+    CachedEval cached_;
+
+    std::string resolve(const std::string& name) const;
+
+    void discover(const std::string& file);
+
+    std::shared_ptr<Source> parse(const std::string& file);
+
+    bool evaluate(const std::string& file);
+};
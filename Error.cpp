@@ -1,15 +1,24 @@
 #include <string>
 #include "Error.h"
 
-Error::Error(const Coordinate& coord, const char* err) {
-    msg = std::to_string(coord.line) + ":" + std::to_string(coord.pos) + ":" + err;
+//строка и позиция считаются только здесь, по индексу строк файла текущего потока
+Error::Error(size_t offset, const char* err) : coord_(Position::lines.coordinate(offset)), err_(err) {
+    msg = std::to_string(coord_.line) + ":" + std::to_string(coord_.pos) + ":" + err;
 }
 
-Error::Error(const Coordinate& coord, const std::string& err) {
-    msg = std::to_string(coord.line) + ":" + std::to_string(coord.pos) + ":" + err;
+Error::Error(size_t offset, const std::string& err) : coord_(Position::lines.coordinate(offset)), err_(err) {
+    msg = std::to_string(coord_.line) + ":" + std::to_string(coord_.pos) + ":" + err;
 }
 
 const char* Error::what() {
     return msg.c_str();
 }
 
+
+const Coordinate& Error::coord() const {
+    return coord_;
+}
+
+const std::string& Error::message() const {
+    return err_;
+}
@@ -5,12 +5,18 @@
 
 class Error : public std::exception {
 public:
-	Error(const Coordinate& coord, const char* err);
+	Error(size_t offset, const char* err);    //offset - смещение во входном файле
 
-	Error(const Coordinate& coord, const std::string& err);
+	Error(size_t offset, const std::string& err);
 
 	const char* what();
+
+	const Coordinate& coord() const;    //для структурированных ответов сервера
+
+	const std::string& message() const; //текст без координат
 private:
 	std::string msg;
+	Coordinate coord_;
+	std::string err_;
 };
 
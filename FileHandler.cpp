@@ -1,11 +1,23 @@
 #include <fstream>
 #include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <climits>
+#include <algorithm>
 
 #include "FileHandler.h"
 
 
 void FileHandler::print_to_out(const std::string& r) {
-    out_ << r; //печать в выходной файл
+    if (r.empty() || !fout_) return;
+    chunks_.push_back({false, buffer_.size(), r.size()});
+    buffer_ += r;   //замены собираются в памяти и пишутся пачкой
+    if (!to_stdout_ && buffer_.size() >= (window_ ? std::min<size_t>(window_, 1u << 20) : (1u << 20))) flush();
 }
 
 int FileHandler::replace_files() {   //замена исходного файла выходным
@@ -19,7 +31,10 @@ int FileHandler::replace_files() {   //замена исходного файл
 }
 
 int FileHandler::remove_out() {      //удаление выходного файла
+    chunks_.clear();
+    buffer_.clear();
     close();
+    if (to_stdout_) return 0;   //в stdout еще ничего не записано
     if (std::remove(fout_)) {
         std::cerr << "Couldn't remove file: " << fin_ << std::endl;
         return 1;
@@ -28,17 +43,184 @@ int FileHandler::remove_out() {      //удаление выходного фа
 }
 
 bool FileHandler::good() {
-    return in_.good() && out_.good();
+    return fd_ != -1 && (data_ || size_ == 0) && (out_fd_ != -1 || !fout_) && out_good_;
+}
+
+bool FileHandler::finish() {
+    close();
+    return out_good_;
+}
+
+void FileHandler::follow_includes(bool f) {
+    follow_ = f;
+}
+
+const std::string& FileHandler::include() const {
+    return include_;
+}
+
+std::string_view FileHandler::text() const {
+    return {data_, size_};
+}
+
+size_t FileHandler::input_size() const {
+    return size_;
+}
+
+void FileHandler::stream(size_t window) {
+    window_ = window;
+}
+
+//страницы до offset больше не нужны: копирование в вывод идет через дескриптор,
+//а если страница все же понадобится (fallback в copy_span), она прочитается заново
+void FileHandler::release(size_t offset) {
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    if (!window_ || !mapped_ || offset < released_ + window_) return;
+    size_t to = (offset - window_) / page * page;
+    if (to <= released_) return;
+    flush();
+    madvise(const_cast<char *>(data_) + released_, to - released_, MADV_DONTNEED);
+    released_ = to;
+}
+
+//копирование диапазона входного файла без участия пользовательского пространства
+void FileHandler::copy_span(size_t offset, size_t length) {
+    loff_t off = offset;
+    size_t left = length;
+    while (left > 0 && mapped_) {
+        ssize_t n = copy_file_range(fd_, &off, out_fd_, nullptr, left, 0);
+        if (n <= 0) break;
+        left -= n;
+    }
+    while (left > 0 && mapped_) {      //copy_file_range не поддерживается (например, другая ФС или канал)
+        off_t soff = off;
+        ssize_t n = sendfile(out_fd_, fd_, &soff, left);
+        if (n <= 0) break;
+        off = soff;
+        left -= n;
+    }
+    while (left > 0) {
+        ssize_t n = ::write(out_fd_, data_ + off, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            out_good_ = false;
+            return;
+        }
+        off += n;
+        left -= n;
+    }
+}
+
+//запись подряд идущих кусков buffer_ одним writev
+void FileHandler::write_buffered(size_t first, size_t last) {
+    std::vector<iovec> iov;
+    for (size_t i = first; i < last; ++i) {
+        iov.push_back({const_cast<char *>(buffer_.data()) + chunks_[i].offset, chunks_[i].length});
+    }
+    size_t done = 0;
+    while (done < iov.size()) {
+        int cnt = static_cast<int>(std::min<size_t>(iov.size() - done, IOV_MAX));
+        ssize_t n = writev(out_fd_, &iov[done], cnt);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            out_good_ = false;
+            return;
+        }
+        while (done < iov.size() && static_cast<size_t>(n) >= iov[done].iov_len) {  //частичная запись
+            n -= iov[done].iov_len;
+            ++done;
+        }
+        if (done < iov.size()) {
+            iov[done].iov_base = static_cast<char *>(iov[done].iov_base) + n;
+            iov[done].iov_len -= n;
+        }
+    }
+}
+
+void FileHandler::flush() {
+    if (out_fd_ == -1) return;
+    size_t i = 0;
+    while (i < chunks_.size() && out_good_) {
+        if (chunks_[i].from_input) {
+            copy_span(chunks_[i].offset, chunks_[i].length);
+            ++i;
+        } else {
+            size_t j = i;
+            while (j < chunks_.size() && !chunks_[j].from_input) ++j;
+            write_buffered(i, j);
+            i = j;
+        }
+    }
+    if (!out_good_) std::cerr << "Couldn't write file: " << fout_ << std::endl;
+    chunks_.clear();
+    buffer_.clear();
 }
 
 void FileHandler::close() {
-    if (in_.is_open()) in_.close();
-    if (out_.is_open()) out_.close();
+    flush();
+    if (mapped_) {
+        munmap(const_cast<char *>(data_), size_);
+        mapped_ = false;
+    }
+    if (fd_ != -1) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    if (out_fd_ != -1) {
+        if (!to_stdout_) ::close(out_fd_);
+        out_fd_ = -1;
+    }
 }
 
-FileHandler::FileHandler(const char *fin, const char *fout) : line_(0), fin_(fin), fout_(fout) {
-    in_.open(fin_);
-    out_.open(fout_);
+int FileHandler::stdout_fd_ = STDOUT_FILENO;
+
+void FileHandler::redirect_stdout() {
+    std::cout.flush();
+    int fd = dup(STDOUT_FILENO);
+    if (fd != -1 && dup2(STDERR_FILENO, STDOUT_FILENO) != -1) stdout_fd_ = fd;
+}
+
+//stdin, который нельзя отобразить (канал), читается в память большими кусками
+void FileHandler::read_piped() {
+    size_t used = 0;
+    piped_.resize(1u << 20);
+    for (;;) {
+        if (piped_.size() - used < (64u << 10)) piped_.resize(piped_.size() * 2);
+        ssize_t n = read(fd_, &piped_[used], piped_.size() - used);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        if (n <= 0) break;
+        used += n;
+    }
+    piped_.resize(used);
+    data_ = piped_.data();
+    size_ = piped_.size();
+}
+
+FileHandler::FileHandler(const char *fin, const char *fout) : fin_(fin), fout_(fout) {
+    bool from_stdin = !std::strcmp(fin_, "-");
+    fd_ = from_stdin ? dup(STDIN_FILENO) : open(fin_, O_RDONLY);
+    struct stat st{};
+    if (fd_ != -1 && from_stdin && (fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode))) {
+        read_piped();
+    } else if (fd_ != -1 && fstat(fd_, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (p != MAP_FAILED) {
+            data_ = static_cast<const char *>(p);
+            size_ = st.st_size;
+            mapped_ = true;
+            madvise(p, size_, MADV_SEQUENTIAL);
+        }
+    }
+    if (fout_ && !std::strcmp(fout_, "-")) {
+        to_stdout_ = true;
+        out_fd_ = stdout_fd_;
+    } else if (fout_) {
+        out_fd_ = open(fout_, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
 }
 
 FileHandler::~FileHandler() {
@@ -48,49 +230,137 @@ FileHandler::~FileHandler() {
 const char *FileHandler::begin_ = "\\begin{preproc}";
 const char *FileHandler::end_ = "\\end{preproc}";
 
+//поиск тега: memchr прыгает сразу к следующему '\', остальной текст не разбирается
+size_t FileHandler::find_tag(size_t from, const char *tag) const {
+    size_t len = std::strlen(tag);
+    const char *end = data_ + size_;
+    const char *p = data_ + from;
+    while (p < end && (p = static_cast<const char *>(std::memchr(p, '\\', end - p)))) {
+        if (static_cast<size_t>(end - p) >= len && !std::memcmp(p, tag, len)) {
+            return p - data_;
+        }
+        ++p;
+    }
+    return std::string::npos;
+}
+
+size_t FileHandler::line_end(size_t pos) const {
+    auto nl = static_cast<const char *>(std::memchr(data_ + pos, '\n', size_ - pos));
+    return nl ? nl - data_ : size_;
+}
+
+//есть ли % в строке перед pos
+bool FileHandler::commented(size_t line_start, size_t pos) const {
+    return std::memchr(data_ + line_start, '%', pos - line_start) != nullptr;
+}
+
+//первая незакомментированная директива \input{...} или \include{...} в [from, to)
+size_t FileHandler::find_include(size_t from, size_t to, size_t &arg_end) {
+    static const char *commands[] = {"\\input", "\\include"};
+    const char *end = data_ + to;
+    const char *p = data_ + from;
+    while (p < end && (p = static_cast<const char *>(std::memchr(p, '\\', end - p)))) {
+        size_t at = p - data_;
+        ++p;
+        for (auto cmd : commands) {
+            size_t len = std::strlen(cmd);
+            if (at + len > to || std::memcmp(data_ + at, cmd, len) != 0) continue;
+            size_t i = at + len;
+            if (i < to && isalpha(data_[i])) continue;  //\inputencoding, \includegraphics
+            while (i < to && (data_[i] == ' ' || data_[i] == '\t')) ++i;
+            if (i >= to || data_[i] != '{') continue;
+            auto close = static_cast<const char *>(std::memchr(data_ + i, '}', to - i));
+            auto nl = static_cast<const char *>(std::memchr(data_ + i, '\n', to - i));
+            if (!close || (nl && nl < close)) continue;
+            auto ls = static_cast<const char *>(memrchr(data_ + from, '\n', at - from));
+            if (commented(ls ? ls - data_ + 1 : from, at)) continue;
+
+            include_.assign(data_ + i + 1, close - data_ - i - 1);
+            include_.erase(0, include_.find_first_not_of(" \t"));
+            include_.erase(include_.find_last_not_of(" \t") + 1);
+            if (cmd == commands[1]) include_ += ".tex";  //\include{x} всегда x.tex
+            arg_end = close - data_ + 1;
+            return at;
+        }
+    }
+    return std::string::npos;
+}
+
+//текст вне preproc не копируется в память, а запоминается как диапазон входного файла
+void FileHandler::write_out(size_t from, size_t to) {
+    if (from >= to || !fout_) return;
+    if (!chunks_.empty() && chunks_.back().from_input &&
+        chunks_.back().offset + chunks_.back().length == from) {
+        chunks_.back().length += to - from;
+    } else {
+        chunks_.push_back({true, from, to - from});
+    }
+    if (to == size_ && data_[to - 1] != '\n') print_to_out("\n");  //последняя строка без перевода строки
+}
+
 ProgramString FileHandler::next() {
-    std::string tmp;
-    std::string program;
-    Coordinate c_begin(line_);
-    Coordinate c_end(line_);
     ProgramString ps;
+    include_.clear();
+    release(cursor_);
+
+    //ищем \begin{preproc}, который находится до %, если % есть
+    size_t pos = cursor_;
+    size_t res;
+    size_t line_start = 0;
+    while ((res = find_tag(pos, begin_)) != std::string::npos) {
+        auto nl = static_cast<const char *>(memrchr(data_ + pos, '\n', res - pos));
+        line_start = nl ? nl - data_ + 1 : pos;
+        if (!commented(line_start, res)) break;
+        pos = line_end(res) + 1;
+    }
+    //директива подключения файла до блока: вернуть пустую программу и имя файла
+    if (follow_) {
+        size_t arg_end;
+        size_t limit = (res == std::string::npos) ? size_ : line_start;
+        if (find_include(cursor_, limit, arg_end) != std::string::npos) {
+            write_out(cursor_, arg_end);
+            cursor_ = arg_end;
+            return ps;
+        }
+    }
+    //строки вне \begin_{preproc}...\end_{preproc} можно сразу писать в файл
+    if (res == std::string::npos) {
+        write_out(cursor_, size_);
+        cursor_ = size_;
+        return ps;
+    }
+    write_out(cursor_, line_start);
 
-    while (std::getline(in_, tmp)) {
-        ++line_;
-        size_t comment = tmp.find('%');
-        size_t res = tmp.find(begin_);
-
-        //в строке есть подстрока \begin{preproc} и она находится до %, если % есть
-        if (res != std::string::npos && res < comment) {
-            c_begin = Coordinate{ line_, res + std::strlen(begin_) + 1 };
-            program += tmp + "\n";
-
-            res = tmp.find(end_);    //если \end{preproc} на той же строке
-            if (res != std::string::npos && res < comment) {
-                c_end = Coordinate{ line_, res + 1 };
-            }
-            else {
-                while (std::getline(in_, tmp)) {
-                    ++line_;
-                    comment = tmp.find('%');
-                    res = tmp.find(end_);
-                    program += tmp + "\n";
-                    if (res != std::string::npos && res < comment) {
-                        c_end = Coordinate{ line_, res + 1 };
-                        break;
-                    }
-                }
-            }
+    size_t first = res - line_start + std::strlen(begin_);
+
+    //\end{preproc} может быть на той же строке
+    size_t stop = size_;
+    size_t last = std::string::npos;
+    pos = line_start;
+    while ((res = find_tag(pos, end_)) != std::string::npos) {
+        auto nl = static_cast<const char *>(memrchr(data_ + pos, '\n', res - pos));
+        size_t end_line_start = nl ? nl - data_ + 1 : pos;
+        if (!commented(end_line_start, res)) {
+            last = res - line_start;
+            stop = line_end(res);
             break;
         }
-        //строки вне \begin_{preproc}...\end_{preproc} можно сразу писать в файл
-        out_ << tmp << std::endl;
+        pos = line_end(res) + 1;
     }
 
-    ps.program = program;
-    ps.begin = c_begin;
-    ps.end = c_end;
-    ps.length = program.length();
+    size_t length = (stop < size_ ? stop + 1 : size_) - line_start;
+    if (window_ && data_[line_start + length - 1] == '\n') {
+        ps.program = std::string_view(data_ + line_start, length);
+        ps.length = length;
+    } else {
+        std::string text(data_ + line_start, length);
+        if (text.back() != '\n') text += '\n';  //последний блок без перевода строки
+        ps.assign(std::move(text));
+    }
+    cursor_ = line_start + length;
+    ps.first = first;
+    ps.last = std::min(last, ps.length);
+    ps.offset = line_start;
 
     return ps;
 }
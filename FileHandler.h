@@ -2,16 +2,19 @@
 
 #include <fstream>
 #include <cstring>
+#include <vector>
 
 #include "Coordinate.h"
 
 
 class FileHandler {
 public:
-    static FileHandler& Instance(const char *fin, const char *fout) {
-        static FileHandler fh(fin, fout);
-        return fh;
-    }
+	FileHandler(const char *fin, const char *fout);   //fout == nullptr - только чтение, "-" - stdin/stdout
+
+	//вывод "-" пойдет в сохраненный дескриптор stdout, а cout интерпретатора - в stderr
+	static void redirect_stdout();
+
+	~FileHandler();
 
 	ProgramString next();   //найти следующее окружение preproc
 
@@ -23,6 +26,23 @@ public:
 
 	bool good();
 
+	bool finish();  //дописать вывод и закрыть файлы, false - ошибка записи
+
+	void follow_includes(bool f);  //останавливаться на \input{...} и \include{...}
+
+	const std::string& include() const;  //файл, на котором остановился next(), или ""
+
+	void write_out(size_t from, size_t to);    //диапазон входного файла в вывод как есть
+
+	size_t input_size() const;
+
+	std::string_view text() const;  //весь входной файл - для Position::lines
+
+	//потоковый режим: блоки ссылаются на отображенный файл, а не копируются,
+	//страницы входа позади курсора старше window байт отдаются системе,
+	//вывод сбрасывается, как только накопится window байт
+	void stream(size_t window);
+
     FileHandler(FileHandler const&) = delete;
     FileHandler& operator=(FileHandler const&) = delete;
 
@@ -31,14 +51,47 @@ private:
 	static const char *end_;
 	const char *fin_;
 	const char *fout_;
-	std::ifstream in_;
-	std::ofstream out_;
-	size_t line_;
+	int fd_ = -1;
+	const char *data_ = nullptr;    //входной файл, отображенный в память
+	size_t size_ = 0;
+	size_t cursor_ = 0;             //начало еще не просмотренной строки
+	bool mapped_ = false;
+	std::string piped_;             //вход из канала, прочитанный целиком (отобразить нельзя)
+	bool to_stdout_ = false;        //вывод собирается целиком и пишется в stdout в finish()
+	static int stdout_fd_;
+	bool follow_ = false;
+	std::string include_;
+	size_t window_ = 0;             //0 - обычный режим
+	size_t released_ = 0;           //до какого смещения страницы входа отданы
 
-	void close();
+	typedef struct Chunk {
+	    bool from_input;    //true - диапазон входного файла, false - диапазон buffer_
+	    size_t offset;
+	    size_t length;
+	} Chunk;
 
-	FileHandler(const char *fin, const char *fout);
+	int out_fd_ = -1;
+	bool out_good_ = true;
+	std::vector<Chunk> chunks_;     //очередь вывода
+	std::string buffer_;            //текст, собранный в памяти (замены)
 
-	~FileHandler();
-};
+	size_t find_tag(size_t from, const char *tag) const;
+
+	size_t line_end(size_t pos) const;
+
+	bool commented(size_t line_start, size_t pos) const;
+
+	size_t find_include(size_t from, size_t to, size_t &arg_end);
+
+	void flush();
+
+	void release(size_t offset);
 
+	void copy_span(size_t offset, size_t length);
+
+	void write_buffered(size_t first, size_t last);
+
+	void close();
+
+	void read_piped();
+};
@@ -0,0 +1,86 @@
+#include "Flat.h"
+#include "Value.h"
+#include "basic_HM.h"
+
+
+FlatTree::FlatTree(Node *root) {
+    add(root);
+}
+
+//узел, потом операнды в том порядке, в котором их вычисляет исполнение, потом дети
+uint32_t FlatTree::add(Node *n) {
+    auto i = static_cast<uint32_t>(kind.size());
+    kind.push_back(n->_tag);
+    left.push_back(NIL);
+    right.push_back(NIL);
+    cond.push_back(NIL);
+    first.push_back(0);
+    count.push_back(static_cast<uint32_t>(n->fields.size()));
+    label.push_back(n->_label);
+    slot.push_back(n->_slot);
+    global.push_back(n->_global);
+    priority.push_back(n->_priority);
+    offset.push_back(n->_offset);
+    source.push_back(n);
+
+    if (n->_tag == NUMBER || n->_tag == KEYWORD || n->_tag == DIMENSION || n->_tag == PMATRIX) {
+        literal.push_back(static_cast<uint32_t>(literals.size()));
+        literals.push_back({n->_number, n->_builtin, n->_dimension, n->_numbers ? n->_numbers->get() : nullptr});
+    } else {
+        literal.push_back(NIL);
+    }
+
+    auto operand = [this](Node *child) {
+        return child ? add(child) : NIL;
+    };
+    if (n->_tag == IF || n->_tag == WHILE || n->_tag == ALT) {
+        cond[i] = operand(n->cond);
+        right[i] = operand(n->right);
+        left[i] = operand(n->left);
+    } else if (n->_tag == SUM || n->_tag == PRODUCT) {
+        left[i] = operand(n->left);
+        cond[i] = operand(n->cond);
+        right[i] = operand(n->right);
+    } else {
+        left[i] = operand(n->left);
+        right[i] = operand(n->right);
+        cond[i] = operand(n->cond);
+    }
+
+    //место под список детей занимается до обхода: списки внуков идут после него
+    size_t from = kids.size();
+    first[i] = static_cast<uint32_t>(from);
+    kids.resize(from + n->fields.size());
+    for (size_t k = 0; k < n->fields.size(); ++k) {
+        uint32_t c = add(n->fields[k]);
+        kids[from + k] = c;
+    }
+    return i;
+}
+
+FlatTree::Ref FlatTree::root() const {
+    return {this, 0};
+}
+
+size_t FlatTree::size() const {
+    return kind.size();
+}
+
+Value FlatTree::exec(Scope *scope) {
+    return evaluate(root(), scope);
+}
+
+void FlatTree::semantic_analysis() const {
+    Ref r = root();
+    if (r.tag() == ROOT) {
+        for (size_t k = 0; k < r.size(); ++k) {
+            analyse(r.field(k), false, {}, false);
+        }
+    } else {
+        analyse(r, false, {}, false);
+    }
+}
+
+void FlatTree::print(const std::string& pref) const {
+    print_tree(root(), pref);
+}
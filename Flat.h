@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Node.h"
+
+
+//дерево блока в плоских массивах: узлы лежат в порядке, в котором их обходит исполнение
+//(родитель, потом операнды в порядке вычисления), ссылки на операнды - индексы.
+//строится по готовому дереву и ссылается на его метки, числа матриц и узлы - живет не дольше арены блока
+class FlatTree {
+public:
+    static constexpr uint32_t NIL = UINT32_MAX;     //нет операнда
+
+    //узел - индекс в массивах дерева; вызовы те же, что у NodeRef
+    typedef struct Ref {
+        const FlatTree *t = nullptr;
+        uint32_t i = NIL;
+
+        explicit operator bool() const { return i != NIL; }
+
+        Tag tag() const { return t->kind[i]; }
+
+        Ref left() const { return {t, t->left[i]}; }
+
+        Ref right() const { return {t, t->right[i]}; }
+
+        Ref cond() const { return {t, t->cond[i]}; }
+
+        size_t size() const { return t->count[i]; }
+
+        Ref field(size_t k) const { return {t, t->kids[t->first[i] + k]}; }
+
+        const std::string& label() const { return *t->label[i]; }
+
+        int slot() const { return t->slot[i]; }
+
+        int global() const { return t->global[i]; }
+
+        int priority() const { return t->priority[i]; }
+
+        size_t offset() const { return t->offset[i]; }
+
+        double number() const { return t->literals[t->literal[i]].number; }
+
+        const Builtin *builtin() const { return t->literals[t->literal[i]].builtin; }
+
+        const std::array<int, 7>& dimension() const { return *t->literals[t->literal[i]].dimension; }
+
+        const NumericMatrix& numbers() const { return *t->literals[t->literal[i]].numbers; }
+
+        Node *node() const { return t->source[i]; }
+    } Ref;
+
+    //значения из текста программы: только у NUMBER, KEYWORD, DIMENSION и PMATRIX
+    typedef struct Literal {
+        double number = 0;
+        const Builtin *builtin = nullptr;
+        const std::array<int, 7> *dimension = nullptr;
+        const NumericMatrix *numbers = nullptr;
+    } Literal;
+
+    //горячие массивы (тег, операнды, дети) отделены от редко читаемых (метки, смещения, исходные узлы)
+    std::vector<Tag> kind;
+    std::vector<uint32_t> left;
+    std::vector<uint32_t> right;
+    std::vector<uint32_t> cond;
+    std::vector<uint32_t> first;        //дети узла: kids[first, first + count)
+    std::vector<uint32_t> count;
+    std::vector<uint32_t> kids;
+    std::vector<uint32_t> literal;      //индекс в literals или NIL
+    std::vector<Literal> literals;
+    std::vector<const std::string *> label;
+    std::vector<int> slot;
+    std::vector<int> global;
+    std::vector<int> priority;
+    std::vector<size_t> offset;
+    std::vector<Node *> source;         //тело функции и \sum исполняются по исходному дереву
+
+    explicit FlatTree(Node *root);
+
+    Ref root() const;
+
+    size_t size() const;
+
+    Value exec(Scope *scope);
+
+    void semantic_analysis() const;
+
+    void print(const std::string& pref) const;
+
+private:
+    uint32_t add(Node *n);
+};
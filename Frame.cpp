@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include "Frame.h"
+
+
+static thread_local CallStack stack;
+static thread_local size_t frames = 0;
+static thread_local size_t depth = 0;
+
+Value *CallStack::push(size_t n, Mark& saved) {
+    saved = {chunk_, top_};
+    if (chunks_.empty() || top_ + n > sizes_[chunk_]) {
+        size_t next = chunks_.empty() ? 0 : chunk_ + 1;
+        if (next == chunks_.size() || sizes_[next] < n) {   //кусок выше вершины свободен, его можно заменить
+            size_t size = std::max(n, chunk_size);
+            if (next == chunks_.size()) {
+                chunks_.emplace_back();
+                sizes_.push_back(0);
+            }
+            chunks_[next].reset(new Value[size]);
+            sizes_[next] = size;
+        }
+        chunk_ = next;
+        top_ = 0;
+    }
+    Value *res = chunks_[chunk_].get() + top_;
+    top_ += n;
+    return res;
+}
+
+void CallStack::pop(Value *slots, size_t n, const Mark& saved) {
+    for (size_t i = 0; i < n; ++i) {
+        slots[i] = Value();
+    }
+    chunk_ = saved.chunk;
+    top_ = saved.top;
+}
+
+Frame::Frame(const Func *f, size_t offset) : func_(f) {
+    if (depth == max_depth) {
+        throw Error(offset, "Recursion is too deep");
+    }
+    slots_ = stack.push(f->slots.size(), saved_);
+    ++depth;
+    ++frames;
+}
+
+Frame::~Frame() {
+    stack.pop(slots_, func_->slots.size(), saved_);
+    --depth;
+}
+
+Value& Frame::operator[](size_t i) {
+    return slots_[i];
+}
+
+Value Frame::run() {
+    Scope scope{slots_, func_};
+    return func_->body->exec(&scope);
+}
+
+size_t Frame::calls() {
+    return frames;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Value.h"
+#include "Error.h"
+
+
+//область имен вызова: ячейки кадра по номерам слотов, под ними - имена, захваченные функцией
+typedef struct Scope {
+    Value *slots = nullptr;
+    const Func *func = nullptr;
+} Scope;
+
+
+//стек кадров потока: кадр - непрерывный отрезок ячеек в куске памяти, куски не переезжают
+//(ссылки на ячейки живут, пока кадр на стеке) и остаются потоку: после разгона вызов памяти не выделяет
+class CallStack {
+public:
+    typedef struct Mark {
+        size_t chunk = 0;
+        size_t top = 0;
+    } Mark;
+
+    Value *push(size_t n, Mark& saved);
+
+    void pop(Value *slots, size_t n, const Mark& saved);    //ячейки очищаются: матрицы и функции освобождаются
+
+private:
+    static const size_t chunk_size = 1024;
+
+    std::vector<std::unique_ptr<Value[]>> chunks_;
+    std::vector<size_t> sizes_;
+    size_t chunk_ = 0;
+    size_t top_ = 0;
+};
+
+
+//кадр вызова пользовательской функции: живет, пока вызов на стеке.
+//глубина вложенности ограничена: исполнение рекурсивно, и стек потока кончится раньше стека кадров
+class Frame {
+public:
+    static const size_t max_depth = 2000;
+
+    Frame(const Func *f, size_t offset);    //offset - место вызова для ошибки о глубине
+
+    ~Frame();
+
+    Frame(const Frame&) = delete;
+    Frame& operator=(const Frame&) = delete;
+
+    Value& operator[](size_t i);    //аргументы - первые ячейки
+
+    Value run();                    //тело функции в этом кадре
+
+    static size_t calls();          //кадров потока с начала работы
+
+private:
+    const Func *func_;
+    Value *slots_;
+    CallStack::Mark saved_;
+};
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+#include "Value.h"
+
+
+static std::mutex names_mutex;
+static std::unordered_map<std::string, int> slots;
+static std::deque<std::string> names;
+static thread_local std::unordered_map<std::string, int> known;    //номера, которые поток уже спрашивал: без блокировки
+
+int GlobalTable::slot(const std::string& name) {
+    auto cached = known.find(name);
+    if (cached != known.end()) {
+        return cached->second;
+    }
+    std::lock_guard<std::mutex> lock(names_mutex);
+    auto it = slots.find(name);
+    if (it == slots.end()) {
+        it = slots.emplace(name, static_cast<int>(names.size())).first;
+        names.push_back(name);
+    }
+    known.emplace(name, it->second);
+    return it->second;
+}
+
+const std::string& GlobalTable::name(int slot) {
+    std::lock_guard<std::mutex> lock(names_mutex);
+    return names[slot];
+}
+
+const Value *GlobalTable::find(int slot) const {
+    if (static_cast<size_t>(slot) >= values_.size() || values_[slot]._type == Value::UNDEFINED) {
+        return nullptr;
+    }
+    return &values_[slot];
+}
+
+Value& GlobalTable::operator[](int slot) {
+    if (static_cast<size_t>(slot) >= values_.size()) {
+        values_.resize(slot + 1);
+    }
+    return values_[slot];
+}
+
+void GlobalTable::clear() {
+    values_.clear();
+}
+
+size_t GlobalTable::size() const {
+    size_t res = 0;
+    for (auto& v : values_) {
+        if (v._type != Value::UNDEFINED) ++res;
+    }
+    return res;
+}
+
+const Value *Captures::find(int slot) const {
+    auto it = std::lower_bound(values_.begin(), values_.end(), slot,
+                               [](const std::pair<int, Value>& p, int s) { return p.first < s; });
+    if (it == values_.end() || it->first != slot) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+void Captures::set(int slot, const Value& v) {
+    auto it = std::lower_bound(values_.begin(), values_.end(), slot,
+                               [](const std::pair<int, Value>& p, int s) { return p.first < s; });
+    if (it != values_.end() && it->first == slot) {
+        it->second = v;
+    } else {
+        values_.emplace(it, slot, v);
+    }
+}
+
+size_t Captures::size() const {
+    return values_.size();
+}
@@ -0,0 +1,255 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <stdexcept>
+
+#include "Json.h"
+
+
+Json::Json(const std::string& s) : type(STRING), string(s) {}
+
+Json::Json(const char *s) : type(STRING), string(s) {}
+
+Json::Json(double d) : type(NUMBER), number(d) {}
+
+Json::Json(bool b) : type(BOOL), boolean(b) {}
+
+Json Json::make_object() {
+    Json j;
+    j.type = OBJECT;
+    return j;
+}
+
+const Json *Json::get(const std::string& key) const {
+    if (type != OBJECT) return nullptr;
+    auto it = object.find(key);
+    return it == object.end() ? nullptr : &it->second;
+}
+
+std::string Json::str(const std::string& key, const std::string& def) const {
+    const Json *j = get(key);
+    return (j && j->type == STRING) ? j->string : def;
+}
+
+Json& Json::operator[](const std::string& key) {
+    type = OBJECT;
+    return object[key];
+}
+
+typedef struct JsonParser {
+    const std::string& s;
+    size_t i = 0;
+
+    explicit JsonParser(const std::string& text) : s(text) {}
+
+    [[noreturn]] void fail(const char *what) const {
+        throw std::runtime_error(std::string(what) + " at offset " + std::to_string(i));
+    }
+
+    void ws() {
+        while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r')) ++i;
+    }
+
+    bool eat(const char *word) {
+        size_t n = std::char_traits<char>::length(word);
+        if (s.compare(i, n, word) != 0) return false;
+        i += n;
+        return true;
+    }
+
+    void put_utf8(std::string& out, unsigned cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+    unsigned hex4() {
+        if (i + 4 > s.size()) fail("Bad \\u escape");
+        unsigned cp = 0;
+        for (int k = 0; k < 4; ++k) {
+            char c = s[i++];
+            cp <<= 4;
+            if (c >= '0' && c <= '9') cp |= c - '0';
+            else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+            else fail("Bad \\u escape");
+        }
+        return cp;
+    }
+
+    std::string string() {
+        ++i;    //"
+        std::string out;
+        while (i < s.size() && s[i] != '"') {
+            char c = s[i++];
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (i >= s.size()) break;
+            c = s[i++];
+            switch (c) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u': {
+                    unsigned cp = hex4();
+                    if (cp >= 0xD800 && cp < 0xDC00 && eat("\\u")) {   //суррогатная пара
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (hex4() - 0xDC00);
+                    }
+                    put_utf8(out, cp);
+                    break;
+                }
+                default: out += c; break;   //\" \\ \/
+            }
+        }
+        if (i >= s.size()) fail("Unterminated string");
+        ++i;
+        return out;
+    }
+
+    Json value() {
+        ws();
+        if (i >= s.size()) fail("Unexpected end of input");
+        Json j;
+        char c = s[i];
+        if (c == '{') {
+            j.type = Json::OBJECT;
+            ++i;
+            ws();
+            if (i < s.size() && s[i] == '}') {
+                ++i;
+                return j;
+            }
+            for (;;) {
+                ws();
+                if (i >= s.size() || s[i] != '"') fail("Expected key");
+                std::string key = string();
+                ws();
+                if (i >= s.size() || s[i] != ':') fail("Expected ':'");
+                ++i;
+                j.object[key] = value();
+                ws();
+                if (i < s.size() && s[i] == ',') {
+                    ++i;
+                } else if (i < s.size() && s[i] == '}') {
+                    ++i;
+                    return j;
+                } else {
+                    fail("Expected ',' or '}'");
+                }
+            }
+        }
+        if (c == '[') {
+            j.type = Json::ARRAY;
+            ++i;
+            ws();
+            if (i < s.size() && s[i] == ']') {
+                ++i;
+                return j;
+            }
+            for (;;) {
+                j.array.push_back(value());
+                ws();
+                if (i < s.size() && s[i] == ',') {
+                    ++i;
+                } else if (i < s.size() && s[i] == ']') {
+                    ++i;
+                    return j;
+                } else {
+                    fail("Expected ',' or ']'");
+                }
+            }
+        }
+        if (c == '"') return Json(string());
+        if (eat("true")) return Json(true);
+        if (eat("false")) return Json(false);
+        if (eat("null")) return j;
+        const char *begin = s.c_str() + i;
+        char *end;
+        double d = std::strtod(begin, &end);
+        if (end == begin) fail("Unexpected symbol");
+        i += end - begin;
+        return Json(d);
+    }
+} JsonParser;
+
+Json Json::parse(const std::string& text) {
+    JsonParser p(text);
+    Json j = p.value();
+    p.ws();
+    if (p.i != text.size()) p.fail("Trailing characters");
+    return j;
+}
+
+std::string json_escape(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+std::string Json::dump() const {
+    switch (type) {
+        case NUL:
+            return "null";
+        case BOOL:
+            return boolean ? "true" : "false";
+        case NUMBER: {
+            if (!std::isfinite(number)) return "null";
+            char buf[32];
+            std::snprintf(buf, sizeof(buf), "%.15g", number);
+            return buf;
+        }
+        case STRING:
+            return json_escape(string);
+        case ARRAY: {
+            std::string out = "[";
+            for (size_t k = 0; k < array.size(); ++k) {
+                if (k) out += ",";
+                out += array[k].dump();
+            }
+            return out + "]";
+        }
+        case OBJECT: {
+            std::string out = "{";
+            bool first = true;
+            for (auto& it : object) {
+                if (!first) out += ",";
+                first = false;
+                out += json_escape(it.first) + ":" + it.second.dump();
+            }
+            return out + "}";
+        }
+    }
+    return "null";
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+
+
+//минимальный JSON для протокола сервера: разбор запроса и запись ответа
+typedef struct Json {
+    typedef enum Type {
+        NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT
+    } Type;
+
+    Type type = NUL;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<Json> array;
+    std::map<std::string, Json> object;
+
+    Json() = default;
+
+    Json(const std::string& s);
+
+    Json(const char *s);
+
+    Json(double d);
+
+    Json(bool b);
+
+    static Json make_object();
+
+    static Json parse(const std::string& text);     //бросает std::runtime_error
+
+    const Json *get(const std::string& key) const;  //поле объекта или nullptr
+
+    std::string str(const std::string& key, const std::string& def = "") const;
+
+    Json& operator[](const std::string& key);
+
+    std::string dump() const;
+} Json;
+
+std::string json_escape(const std::string& s);
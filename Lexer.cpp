@@ -1,5 +1,8 @@
 #include <vector>
 #include <string>
+#include <cstring>
+#include <algorithm>
+#include <charconv>
 
 #include "Lexer.h"
 
@@ -12,365 +15,367 @@ Lexer::Lexer(const Position& p, const ProgramString&) {
 
 Lexer::~Lexer() = default;
 
+//срез текста блока с позиции start, если там записано s, иначе сохраненная копия
+std::string_view Lexer::keep(const Position& start, const std::string& s) {
+    std::string_view text = Position::ps.program;
+    if (start.index <= text.size() && text.compare(start.index, s.size(), s) == 0) {
+        return text.substr(start.index, s.size());
+    }
+    return keep(s);
+}
 
-std::vector<Token> Lexer::next() {
-    std::vector<Token> v;
-    if (!current.end_of_program()) {
-        Position start = current;
-        char c = current.get(); //сохранить текущий символ и перейти на следующий
-        std::string tmp;
-
-        if (c == '\n' && isProduct) {
-            if (product_iter_tokens.size() == product_tokens.size()) {
-                isProduct = false;
-                for (int i = product_tokens.size() - 1; i >= 0; i--) {
-                    v.push_back(product_iter_tokens[i]);
-                    v.emplace_back(start, current, SET);
-                    v.push_back(product_iter_tokens[i]);
-                    v.emplace_back(start, current, ADD);
-                    v.emplace_back(start, current, NUMBER, "1");
-                    v.push_back(product_tokens[i]);
-                    v.emplace_back(start, current, ENDB, "\\end");
-                    v.emplace_back(start, current, ENDB, "\\end");
-                }
-                return v;
-            } else {
-                std::cout << "iters != products";  // не должно выполняться
-            }
-        } else if (c == '\n' && isSum) {
-            if (sum_tokens.size() == sum_iter_tokens.size()) {
-                isSum = false;
-                for (int i = sum_tokens.size() - 1; i >= 0; i--) {
-//                    std::cout << "iter = " << i << std::endl;
-                    v.push_back(sum_iter_tokens[i]);
-                    v.emplace_back(start, current, SET);
-                    v.push_back(sum_iter_tokens[i]);
-                    v.emplace_back(start, current, ADD);
-                    v.emplace_back(start, current, NUMBER, "1");
-                    v.emplace_back(start, current, ENDB, "\\end");
-                    v.push_back(sum_tokens[i]);
-                    v.emplace_back(start, current, ENDB, "\\end");
-                }
-                return v;
-            } else {
-                std::cout << "iters != sums";  // не должно выполняться
-            }
-        } else if (isspace(c)) {
-            while (isspace(current.cur())) current++;
-            v.emplace_back(start, current, SPACE);
-            return v;
-        } else if (c == '%') { //комментарии игнорируются до следующей строки
-            do { current++; } while (!current.is_at_newline());
-            v.emplace_back(start, current, SPACE);
-            return v;
-        } else if (c == '\\') {
-            if (!current.end_of_program() && current.cur() == '\\') {
-                current++;
-                v.emplace_back(start, current, BREAK, "\\\\");
-                return v;
-            }
-            for (tmp = c; isalpha(current.cur());) tmp += current.get();
-
-            Tag tmp_tag = KEYWORD;
-            auto res = raw_tag.find(tmp);
-            if (res != raw_tag.end()) {
-                tmp_tag = res->second;
-                std::string attrib;
-                if (tmp_tag == PLACEHOLDER) {
-                    if (current.cur() == '[') {
-                        current.get();
-                        isPlaceholder = true;
-
-                        auto tmp_cur = current;
-                        while (current.cur() != ']') current.get();
-                        current.get();
-                        if (!get_attribute(attrib)) throw Error(current.start, "Expected {...}");
-
-                        v.emplace_back(start, current, PLACEHOLDER, tmp);
-                        v.emplace_back(start, tmp_cur, DIV);
-                        v.emplace_back(start, tmp_cur, LPAREN);
-                        current = tmp_cur;
-                        return v;
-                    } else {
-                        if (!get_attribute(attrib)) throw Error(current.start, "Expected {...}");
-                        v.emplace_back(start, current, PLACEHOLDER, tmp);
-                        return v;
-                    }
-                }
-                if (tmp_tag == BEGIN || tmp_tag == END) {
-                    if (!get_attribute(attrib)) throw Error(current.start, "Expected {...}");
-                    switch (tmp_tag) {
-                        case BEGIN:
-                            if (attrib == "{block}") {
-                                v.emplace_back(start, current, BEGINB, tmp);
-                                return v;
-                            } else if (attrib == "{caseblock}") {
-                                v.emplace_back(start, current, BEGINC, tmp);
-                                return v;
-                            } else if (attrib == "{pmatrix}") {
-                                v.emplace_back(start, current, BEGINM, tmp);
-                                return v;
-                            }
-                        case END:
-                            if (attrib == "{block}") {
-                                v.emplace_back(start, current, ENDB, tmp);
-                                return v;
-                            } else if (attrib == "{caseblock}") {
-                                v.emplace_back(start, current, ENDC, tmp);
-                                return v;
-                            } else if (attrib == "{pmatrix}") {
-                                v.emplace_back(start, current, ENDM, tmp);
-                                return v;
-                            }
-                        default:
-                            break;
-                    }
-                } else if (tmp_tag == SUM) {
-                    current.get(); // прочитали _
-
-                    sumName = "sum" + std::to_string(random());
-
-                    v.emplace_back(start, current, BEGINB, "\\begin");
-
-                    v.emplace_back(start, current, IDENT, sumName);
-                    v.emplace_back(start, current, SET);
-                    v.emplace_back(start, current, NUMBER, "0");
-
-                    std::string lower_bound;
-                    if (!get_attribute(lower_bound)) throw Error(current.start, "Expected {...}");
-                    std::vector<Token> lower = parse_sum_lower_bound(lower_bound);
-
-                    current.get(); // прочитали ^
-
-                    std::string upper_bound;
-                    if (!get_attribute(upper_bound)) throw Error(current.start, "Expected {...}");
-                    std::vector<Token> upper = parse_sum_upper_bound(upper_bound);
-
-                    v.insert(v.end(), lower.begin(), lower.end());
-                    v.emplace_back(start, current, WHILE, "\\while");
-                    v.emplace_back(start, current, LBRACE);
-                    v.push_back(lower[0]);
-                    v.emplace_back(start, current, LEQ);
-                    v.push_back(upper[0]);
-                    v.emplace_back(start, current, RBRACE);
-                    v.emplace_back(start, current, BEGINB, "\\begin");
-
-                    v.emplace_back(start, current, IDENT, sumName);
-                    v.emplace_back(start, current, SET);
-                    v.emplace_back(start, current, IDENT, sumName);
-                    v.emplace_back(start, current, ADD);
-                    sum_tokens.emplace_back(start, current, IDENT, sumName);
-                    sum_iter_tokens.push_back(lower[0]);
-
-                    isSum = true;
-
-                    return v;
-                } else if (tmp_tag == PRODUCT) {
-                    isProduct = true;
-
-                    productName = "product" + std::to_string(random());
-
-                    current.get(); // прочитали _
-
+std::string_view Lexer::keep(const std::string& s) {
+    return Token::symbols.keep(s);
+}
 
-                    v.emplace_back(start, current, BEGINB, "\\begin");
-                    v.emplace_back(start, current, IDENT, productName);
-                    v.emplace_back(start, current, SET);
-                    v.emplace_back(start, current, NUMBER, "1");
 
-                    std::string lower_bound;
-                    if (!get_attribute(lower_bound)) throw Error(current.start, "Expected {...}");
-                    std::vector<Token> lower = parse_sum_lower_bound(lower_bound);
+//классы символов: биты для сканирования серий и вид лексемы, которую символ начинает
+enum Char_class : unsigned char {
+    C_SPACE = 1, C_ALPHA = 2, C_DIGIT = 4
+};
 
-                    current.get(); // read ^
+enum Char_kind : unsigned char {
+    K_OTHER, K_SPACE, K_ALPHA, K_DIGIT, K_BACKSLASH, K_PERCENT, K_SINGLE, K_SPECIAL
+};
 
-                    std::string upper_bound;
-                    if (!get_attribute(upper_bound)) throw Error(current.start, "Expected {...}");
-                    std::vector<Token> upper = parse_sum_upper_bound(upper_bound);
+typedef struct Char_table {
+    unsigned char cls[256] = {};
+    Char_kind kind[256] = {};
+    Tag single[256] = {};   //тег односимвольной лексемы для K_SINGLE
+} Char_table;
+
+static constexpr Char_table make_char_table() {
+    Char_table t{};
+    for (int c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+        t.cls[c] = C_SPACE;
+        t.kind[c] = K_SPACE;
+    }
+    for (int c = 'a'; c <= 'z'; ++c) {
+        t.cls[c] = t.cls[c - 'a' + 'A'] = C_ALPHA;
+        t.kind[c] = t.kind[c - 'a' + 'A'] = K_ALPHA;
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        t.cls[c] = C_DIGIT;
+        t.kind[c] = K_DIGIT;
+    }
+    t.kind[static_cast<int>('\\')] = K_BACKSLASH;
+    t.kind[static_cast<int>('%')] = K_PERCENT;
+    const std::pair<char, Tag> single[] = {
+        {'+', ADD}, {'-', SUB}, {'*', MUL}, {'/', DIV}, {'^', POW}, {'(', LPAREN}, {')', RPAREN},
+        {',', COMMA}, {'[', LBRACKET}, {'_', INDEX}, {'<', LT}, {'>', GT}, {'=', EQ}, {'&', AMP}
+    };
+    for (auto& s : single) {
+        t.kind[static_cast<int>(s.first)] = K_SINGLE;
+        t.single[static_cast<int>(s.first)] = s.second;
+    }
+    for (int c : {'{', '}', ']', ':'}) {
+        t.kind[c] = K_SPECIAL;      //зависят от состояния лексера
+    }
+    return t;
+}
 
-                    v.insert(v.end(), lower.begin(), lower.end());
-                    v.emplace_back(start, current, PRODUCT, "\\product");
-                    //cond
-                    v.emplace_back(start, current, LBRACE);
-                    v.push_back(lower[0]);
-                    v.emplace_back(start, current, LEQ);
-                    v.push_back(upper[0]);
-                    v.emplace_back(start, current, RBRACE);
+static constexpr Char_table chars = make_char_table();
 
-                    v.emplace_back(start, current, BEGINB, "\\begin");
-                    v.emplace_back(start, current, IDENT, productName);
-                    v.emplace_back(start, current, SET);
-                    v.emplace_back(start, current, IDENT, productName);
-                    v.emplace_back(start, current, MUL);
 
-                    product_tokens.emplace_back(start, current, IDENT, productName);
-                    product_iter_tokens.push_back(lower[0]);
+size_t Lexer::scan(size_t from, unsigned char cls) const {
+    const char *p = text_.data();
+    while (from < end_ && (chars.cls[static_cast<unsigned char>(p[from])] & cls)) ++from;
+    return from;
+}
 
-                    return v;
-                } else if (tmp_tag == FLOOR) {
-                    isFloor = true;
+//числа записываются так же, как их читает next(): без экспоненты, ноль в начале - отдельное число;
+//все остальное (размерности, выражения, комментарии, неровные строки) разбирает обычный путь
+bool Lexer::numeric_matrix(size_t from, size_t& to, NumericMatrix& m) const {
+    static const std::string_view end_tag = "\\end{pmatrix}";
+    const char *p = text_.data();
+    size_t col = 0;
+    for (size_t i = from;;) {
+        i = scan(i, C_SPACE);
+        size_t j = (i < end_ && p[i] == '-') ? i + 1 : i;
+        if (j >= end_ || !(chars.cls[static_cast<unsigned char>(p[j])] & C_DIGIT)) return false;
+        size_t e = (p[j] == '0') ? j + 1 : scan(j + 1, C_DIGIT);
+        if (e < end_ && p[e] == '.') e = scan(e + 1, C_DIGIT);
+        double d;
+        auto r = std::from_chars(p + i, p + e, d);
+        if (r.ec != std::errc() || r.ptr != p + e) return false;
+        m.data.push_back(d);
+        ++col;
+
+        i = scan(e, C_SPACE);
+        if (i < end_ && p[i] == '&') {
+            ++i;
+            continue;
+        }
+        bool last = i + end_tag.size() <= end_ && text_.compare(i, end_tag.size(), end_tag) == 0;
+        if (!last && (i + 2 > end_ || p[i] != '\\' || p[i + 1] != '\\')) return false;
+        if (m.rows == 0) m.cols = col;
+        else if (col != m.cols) return false;
+        ++m.rows;
+        col = 0;
+        if (last) {
+            to = i + end_tag.size();
+            return true;
+        }
+        i += 2;
+    }
+}
 
-                    current.get(); //read *
-                    if (current.get() == '{') {
-                        v.emplace_back(start, current, KEYWORD, "\\floor");
-                        v.emplace_back(start, current, LPAREN);
-                    } else throw Error(current.start, "Expected {...}");
+std::shared_ptr<const NumericMatrix> Lexer::literal(uint32_t offset) const {
+    auto it = std::lower_bound(literals_.begin(), literals_.end(), offset,
+                               [](const auto& l, uint32_t o) { return l.first < o; });
+    return (it != literals_.end() && it->first == offset) ? it->second : nullptr;
+}
 
-                    return v;
-                } else if (tmp_tag == CEIL) {
-                    isCeil = true;
+void Lexer::close_series(std::vector<Token>& v, const Position& at) {
+    v.insert(v.end(), open_series, Token(at, current, ENDSUM));
+    open_series = 0;
+}
 
-                    current.get(); //read *
-                    if (current.get() == '{') {
-                        v.emplace_back(start, current, KEYWORD, "\\ceil");
-                        v.emplace_back(start, current, LPAREN);
-                    } else throw Error(current.start, "Expected {...}");
+Tag Lexer::next(std::vector<Token>& v) {
+    size_t n = v.size();
+    if (!current.end_of_program()) {
+        Position start = current;
+        size_t i = current.index;
+        char c = text_[i];
+        std::string tmp;
 
-                    return v;
+        if (c == '\n' && open_series > 0) {    //тела всех открытых \sum и \prod заканчиваются в конце строки
+            current.advance(i + 1);
+            close_series(v, start);
+            return ENDSUM;
+        }
+        switch (chars.kind[static_cast<unsigned char>(c)]) {
+            case K_SPACE:       //пробелы и комментарии токенов не дают
+                current.advance(scan(i + 1, C_SPACE));
+                return SPACE;
+            case K_PERCENT: {   //комментарии игнорируются до следующей строки
+                current.advance(i + 1);
+                ++current;      //символ сразу после % пропускается, даже если это перевод строки
+                size_t j = current.index;
+                auto nl = static_cast<const char *>(std::memchr(text_.data() + j, '\n', end_ > j ? end_ - j : 0));
+                size_t k = nl ? nl - text_.data() : std::max(j, end_);
+                if (k > j && text_[k - 1] == '\r') --k;
+                current.advance(k);
+                return SPACE;
+            }
+            case K_BACKSLASH: {
+                current.advance(i + 1);
+                if (!current.end_of_program() && current.cur() == '\\') {
+                    current++;
+                    close_series(v, start);     //и перед \\ тоже
+                    v.emplace_back(start, current, BREAK, "\\\\");
+                    return v[n]._tag;
                 }
+                std::string_view word = text_.substr(i, scan(i + 1, C_ALPHA) - i);
+                current.advance(i + word.size());
+
+                Tag tmp_tag = KEYWORD;
+                if (const Tag *res = raw_tag.find(word)) {
+                    tmp_tag = *res;
+                    std::string attrib;
+                    if (tmp_tag == PLACEHOLDER) {
+                        if (current.cur() == '[') {
+                            current.get();
+                            isPlaceholder = true;
+
+                            auto tmp_cur = current;
+                            while (current.cur() != ']') current.get();
+                            current.get();
+                            if (!get_attribute(attrib)) throw Error(current.offset(), "Expected {...}");
+
+                            v.emplace_back(start, current, PLACEHOLDER, word);
+                            v.emplace_back(start, tmp_cur, DIV);
+                            v.emplace_back(start, tmp_cur, LPAREN);
+                            current = tmp_cur;
+                            return PLACEHOLDER;
+                        } else {
+                            if (!get_attribute(attrib)) throw Error(current.offset(), "Expected {...}");
+                            v.emplace_back(start, current, PLACEHOLDER, word);
+                            return PLACEHOLDER;
+                        }
+                    }
+                    if (tmp_tag == BEGIN || tmp_tag == END) {
+                        if (!get_attribute(attrib)) throw Error(current.offset(), "Expected {...}");
+                        Tag env = NONE;
+                        if (attrib == "{block}") env = tmp_tag == BEGIN ? BEGINB : ENDB;
+                        else if (attrib == "{caseblock}") env = tmp_tag == BEGIN ? BEGINC : ENDC;
+                        else if (attrib == "{pmatrix}") env = tmp_tag == BEGIN ? BEGINM : ENDM;
+                        //числовая матрица - один токен; в теле \sum \\ и конец строки закрывают ряд, там - обычный путь
+                        if (env == BEGINM && open_series == 0) {
+                            auto m = std::make_shared<NumericMatrix>();
+                            size_t to;
+                            if (numeric_matrix(current.index, to, *m)) {
+                                current.advance(to);
+                                literals_.emplace_back(static_cast<uint32_t>(start.index), std::move(m));
+                                v.emplace_back(start, current, PMATRIX);
+                                return PMATRIX;
+                            }
+                        }
+                        if (env != NONE) {
+                            v.emplace_back(start, current, env, word);
+                            return env;
+                        }
+                    } else if (tmp_tag == SUM || tmp_tag == PRODUCT) {
+                        ++open_series;  //пределы разбирает парсер, тело - до конца строки
+                    } else if (tmp_tag == FLOOR) {
+                        isFloor = true;
+
+                        current.get(); //read *
+                        if (current.get() == '{') {
+                            v.emplace_back(start, current, KEYWORD, "\\floor");
+                            v.emplace_back(start, current, LPAREN);
+                        } else throw Error(current.offset(), "Expected {...}");
+
+                        return KEYWORD;
+                    } else if (tmp_tag == CEIL) {
+                        isCeil = true;
+
+                        current.get(); //read *
+                        if (current.get() == '{') {
+                            v.emplace_back(start, current, KEYWORD, "\\ceil");
+                            v.emplace_back(start, current, LPAREN);
+                        } else throw Error(current.offset(), "Expected {...}");
+
+                        return KEYWORD;
+                    }
+                }
+                v.emplace_back(start, current, tmp_tag, word);
+                return tmp_tag;
             }
-            v.emplace_back(start, current, tmp_tag, tmp);
-            return v;
-        } else if (isalpha(c)) {
-            for (tmp = c; isalpha(current.cur()) || isdigit(current.cur());) tmp += current.get();
-            auto res = dim_tag.find(tmp);
-
-            if (res != dim_tag.end()) {
-                v.emplace_back(start, current, DIMENSION, tmp);
-                return v;
-            } else if (current.can_peek() && current.cur() == '_' &&
-                       current.peek() == '\\') {   //это не может быть индекс, потому что после '_' идет '\'
-                tmp += current.get();   //прочитать '_'
-                std::string kw;
-                kw += current.get();
-                while (isalpha(current.cur())) { kw += current.get(); } //прочитать '\text'
-                if (kw != "\\text") throw Error(current.start, "Expected \\text{...}");
-                if (!get_attribute(kw)) throw Error(current.start, "Expected {...}");
-                tmp += kw;
+            case K_ALPHA: {
+                std::string_view word = text_.substr(i, scan(i + 1, C_ALPHA | C_DIGIT) - i);
+                current.advance(i + word.size());
+
+                if (dimensions.find(word)) {
+                    v.emplace_back(start, current, DIMENSION, word);
+                    return DIMENSION;
+                } else if (current.can_peek() && current.cur() == '_' &&
+                           current.peek() == '\\') {   //это не может быть индекс, потому что после '_' идет '\'
+                    tmp = word;
+                    tmp += current.get();   //прочитать '_'
+                    std::string kw;
+                    kw += current.get();
+                    while (isalpha(current.cur())) { kw += current.get(); } //прочитать '\text'
+                    if (kw != "\\text") throw Error(current.offset(), "Expected \\text{...}");
+                    if (!get_attribute(kw)) throw Error(current.offset(), "Expected {...}");
+                    tmp += kw;
+                    v.emplace_back(start, current, IDENT, keep(start, tmp));
+                    return IDENT;
+                }
+                v.emplace_back(start, current, IDENT, word);
+                return IDENT;
             }
-            v.emplace_back(start, current, IDENT, tmp);
-            return v;
-        } else if (isdigit(c)) {
-            tmp = c;
-            if (c != '0') while (isdigit(current.cur())) tmp += current.get();
-            if (!current.end_of_program() && current.cur() == '.') {
-                tmp += current.get();
-                while (isdigit(current.cur())) tmp += current.get();
+            case K_DIGIT: {
+                size_t e = (c == '0') ? i + 1 : scan(i + 1, C_DIGIT);
+                if (e < end_ && text_[e] == '.') e = scan(e + 1, C_DIGIT);
+                current.advance(e);
+                v.emplace_back(start, current, NUMBER, text_.substr(i, e - i));
+                return NUMBER;
             }
-            v.emplace_back(start, current, NUMBER, tmp);
-            return v;
-        } else {
-            switch (c) {
-                case '+':
-                    v.emplace_back(start, current, ADD);
-                    return v;
-                case '-':
-                    v.emplace_back(start, current, SUB);
-                    return v;
-                case '*':
-                    v.emplace_back(start, current, MUL);
-                    return v;
-                case '/':
-                    v.emplace_back(start, current, DIV);
-                    return v;
-                case '^':
-                    v.emplace_back(start, current, POW);
-                    return v;
-                case '(':
-                    v.emplace_back(start, current, LPAREN);
-                    return v;
-                case ')':
-                    v.emplace_back(start, current, RPAREN);
-                    return v;
-                case ',':
-                    v.emplace_back(start, current, COMMA);
-                    return v;
-                case '{':
-                    if (!isPlaceholder) {
-                        v.emplace_back(start, current, LBRACE);
-                    } else {
-                        v.emplace_back(current, current, SKIP);
-                    }
-                    return v;
-                case '}':
-                    if (!isPlaceholder && !isFloor && !isCeil) {
-                        v.emplace_back(start, current, RBRACE);
-                    } else {
+            case K_SINGLE:
+                current.advance(i + 1);
+                v.emplace_back(start, current, chars.single[static_cast<unsigned char>(c)]);
+                return v[n]._tag;
+            case K_SPECIAL:
+                current.advance(i + 1);
+                switch (c) {
+                    case '{':
+                        if (!isPlaceholder) {
+                            v.emplace_back(start, current, LBRACE);
+                            return LBRACE;
+                        }
+                        return SKIP;
+                    case '}':
+                        if (!isPlaceholder && !isFloor && !isCeil) {
+                            v.emplace_back(start, current, RBRACE);
+                            return RBRACE;
+                        }
                         if (isPlaceholder) {
                             isPlaceholder = false;
-                            v.emplace_back(current, current, SKIP);
+                            return SKIP;
                         } else if (isFloor) {
                             isFloor = false;
-                            v.emplace_back(start, current, RPAREN);
                         } else {
                             isCeil = false;
-                            v.emplace_back(start, current, RPAREN);
                         }
-                    }
-                    return v;
-                case '[':
-                    v.emplace_back(start, current, LBRACKET);
-                    return v;
-                case ']':
-                    if (!isPlaceholder) {
-                        v.emplace_back(start, current, RBRACKET);
-                    } else {
                         v.emplace_back(start, current, RPAREN);
-                    }
-                    return v;
-                case '_':
-                    v.emplace_back(start, current, INDEX);
-                    return v;
-                case '<':
-                    v.emplace_back(start, current, LT);
-                    return v;
-                case '>':
-                    v.emplace_back(start, current, GT);
-                    return v;
-                case '=':
-                    v.emplace_back(start, current, EQ);
-                    return v;
-                case '&':
-                    v.emplace_back(start, current, AMP);
-                    return v;
-                case ':':
-                    if (!current.end_of_program() && current.cur() == '=') {
-                        v.emplace_back(start, ++current, SET);
-                        return v;
-                    }
-                default:
-                    v.emplace_back(start, current);
-                    return v;
-            }
+                        return RPAREN;
+                    case ']':
+                        v.emplace_back(start, current, isPlaceholder ? RPAREN : RBRACKET);
+                        return v[n]._tag;
+                    case ':':
+                        if (!current.end_of_program() && current.cur() == '=') {
+                            v.emplace_back(start, ++current, SET);
+                            return SET;
+                        }
+                    default:
+                        break;
+                }
+                v.emplace_back(start, current);
+                return ERROR;
+            default:
+                ++current;
+                v.emplace_back(start, current);
+                return ERROR;
         }
     }
+    if (open_series > 0) {  //блок кончился раньше строки
+        close_series(v, current);
+        return ENDSUM;
+    }
     v.emplace_back(current, current, NONE);
-    return v;
+    return NONE;
 }
 
-std::vector<Token> Lexer::program_to_tokens(const ProgramString& ps) {
-    std::vector<Token> res;
+void Lexer::start(const ProgramString& ps) {
     Position::ps = ps;
-    current = Position(ps.begin, ps.begin.pos - 1);
-    Tag t;
-    bool skip = false;
-    do {
-        std::vector<Token> x = next();
+    current = Position(ps.first);
+    text_ = Position::ps.program;
+    if (text_.size() > UINT32_MAX) {
+        throw Error(ps.offset, "Block is too large");
+    }
+    Token::symbols.clear();
+    end_ = std::min(ps.last, text_.size());
+
+    literals_.clear();
+    queue_.clear();
+    head_ = 0;
+    skip_ = done_ = false;
+    isPlaceholder = isFloor = isCeil = false;
+    open_series = 0;
+}
 
-        t = x[0]._tag;
+Token Lexer::pull() {
+    while (head_ == queue_.size()) {
+        queue_.clear();     //память очереди остается, новых выделений нет
+        head_ = 0;
+        if (done_) {
+            queue_.emplace_back(current, current, NONE);
+            break;
+        }
+        Tag t = next(queue_);
         if (t == BEGIN) {
-            skip = true;
+            skip_ = true;
         }
-        if (!skip && t != SPACE && t != SKIP) {
-            if (t == ERROR) {
-                throw Error(x[0].start.start, "Unexpected symbol");
-            }
-            res.insert(res.end(), x.begin(), x.end());
+        if (skip_) {
+            queue_.clear();
+        } else if (t == ERROR) {
+            throw Error(queue_[0].at(), "Unexpected symbol");
         }
         if (t == END) {
-            skip = false;
+            skip_ = false;
         }
-    } while (t != NONE);
+        done_ = t == NONE;
+    }
+    return queue_[head_++];
+}
+
+std::vector<Token> Lexer::program_to_tokens(const ProgramString& ps) {
+    std::vector<Token> res;
+    start(ps);
+    do {
+        res.push_back(pull());
+    } while (res.back()._tag != NONE);
     return res;
 }
 
@@ -387,89 +392,3 @@ bool Lexer::get_attribute(std::string &s) {
     } while (lb != rb && !current.end_of_program());
     return lb == rb;
 }
-
-std::vector<Token> Lexer::parse_sum_lower_bound(std::string s) {
-    Position start = current;
-    std::vector<Token> v;
-    int i = 1;
-    std::string ident;
-    std::string bound;
-
-    bool ident_not_found = true;
-    bool bound_not_found = true;
-
-    while (i < s.length() && (ident_not_found || bound_not_found)) {
-        if (isalpha(s[i])) {
-            while (isalpha(s[i])) {
-                ident += s[i];
-                i++;
-            }
-            ident_not_found = false;
-        } else if (isdigit(s[i])) {
-            bound = s[i];
-            if (s[i] != '0') {
-                i++;
-                while (isdigit(s[i])) {
-                    bound += s[i];
-                    i++;
-                }
-            }
-            if (s[i] == '.') {
-                bound += s[i];
-                i++;
-                while (isdigit(s[i])) {
-                    bound += s[i];
-                    i++;
-                }
-            }
-            bound_not_found = false;
-        }
-        i++;
-    }
-    v.emplace_back(start, current, IDENT, ident);
-    v.emplace_back(start, current, SET);
-    v.emplace_back(start, current, NUMBER, bound);
-
-    return v;
-}
-
-std::vector<Token> Lexer::parse_sum_upper_bound(std::string s) {
-    Position start = current;
-    std::vector<Token> v;
-    int i = 1;
-    std::string bound;
-
-    bool bound_not_found = true;
-
-    while (i < s.length() && bound_not_found) {
-        if (isdigit(s[i])) {
-            bound = s[i];
-            if (s[i] != '0') {
-                i++;
-                while (isdigit(s[i])) {
-                    bound += s[i];
-                    i++;
-                }
-            }
-            if (s[i] == '.') {
-                bound += s[i];
-                i++;
-                while (isdigit(s[i])) {
-                    bound += s[i];
-                    i++;
-                }
-            }
-            bound_not_found = false;
-            v.emplace_back(start, current, NUMBER, bound);
-        } else if (isalpha(s[i])) {
-            while (isalpha(s[i])) {
-                bound += s[i];
-                i++;
-            }
-            bound_not_found = false;
-            v.emplace_back(start, current, IDENT, bound);
-        }
-        i++;
-    }
-    return v;
-}
\ No newline at end of file
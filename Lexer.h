@@ -1,8 +1,9 @@
 #pragma once
 
 #include <vector>
-#include <random>
 #include <string>
+#include <string_view>
+#include <memory>
 
 #include "Coordinate.h"
 #include "Defines.h"
@@ -12,29 +13,36 @@
 class Lexer {
 private:
     Position current;
+    std::string_view text_;     //текст блока
+    size_t end_ = 0;            //индекс ps.last в тексте: дальше курсор не двигается
 
     bool get_attribute(std::string &);
 
-    std::vector<Token> next();
+    Tag next(std::vector<Token>& v);    //дописать токены следующей лексемы, вернуть тег первого
 
-    std::vector<Token> parse_sum_lower_bound(std::string s);
+    size_t scan(size_t from, unsigned char cls) const;  //первый индекс, символ которого не из классов cls
 
-    std::vector<Token> parse_sum_upper_bound(std::string s);
+    //pmatrix с индекса from до \end{pmatrix} - только числа, & и \\: разобрать в m, to - индекс за концом
+    bool numeric_matrix(size_t from, size_t& to, NumericMatrix& m) const;
+
+    std::vector<std::pair<uint32_t, std::shared_ptr<const NumericMatrix>>> literals_;  //по смещению токена PMATRIX
 
-    bool isSum = false;
-    bool isProduct = false;
     bool isPlaceholder = false;
     bool isFloor = false;
     bool isCeil = false;
 
-    std::vector<Token> sum_tokens;
-    std::vector<Token> sum_iter_tokens;
+    size_t open_series = 0;     //\sum и \prod, тела которых еще не закрыты ENDSUM
+
+    void close_series(std::vector<Token>& v, const Position& at);
+
+    std::string_view keep(const Position& start, const std::string& s);
 
-    std::vector<Token> product_tokens;
-    std::vector<Token> product_iter_tokens;
+    std::string_view keep(const std::string& s);
 
-    std::string sumName;
-    std::string productName;
+    std::vector<Token> queue_;  //токены лексемы, еще не отданные pull(): \placeholder[...] и конец строки после \sum дают несколько
+    size_t head_ = 0;
+    bool skip_ = false;         //внутри \begin{...}, который не блок, матрица или caseblock
+    bool done_ = false;         //NONE уже был
 
 public:
     Lexer();
@@ -43,5 +51,15 @@ public:
 
     ~Lexer();
 
-    std::vector<Token> program_to_tokens(const ProgramString&);
+    //тексты токенов - в Token::symbols, координаты - в Position::lines;
+    //и то, и другое действительно до разбора следующего блока в этом потоке
+    void start(const ProgramString&);
+
+    //следующий токен блока: пробелы и окружения, которые не разбираются, пропускаются,
+    //в конце блока - NONE, сколько бы раз pull() ни вызывался
+    Token pull();
+
+    std::vector<Token> program_to_tokens(const ProgramString&);     //все токены сразу (для замеров)
+
+    std::shared_ptr<const NumericMatrix> literal(uint32_t offset) const;    //числа токена PMATRIX
 };
\ No newline at end of file
@@ -1,77 +1,186 @@
+#include <algorithm>
+
 #include "Node.h"
+#include "Flat.h"
+#include "Value.h"
+#include "Lexer.h"
 #include "Error.h"
+#include "Serialize.h"
 
 
+//последний токен программы - NONE, дальше него курсор не двигается
 Token* Parser::next() {
-    return &program[++i];
+    if (current._tag != NONE) current = lexer->pull();
+    return &current;
 }
 
 Token* Parser::cur() {
-    return &program[i];
+    return &current;
 }
 
 Token* Parser::get() {
-    return &program[i++];
+    taken = current;
+    next();
+    return &taken;
 }
 
 bool Parser::skip(Tag x) {
     if (x != 0 && (cur()->_tag != x)) {
         return false;
-    } else {
-        i++;
     }
+    next();
     return true;
 }
 
-void Parser::init(std::vector<Token> &ts) {
-    program = ts;
-    i = 0;
+void Parser::init(Lexer &l, Arena &a) {
+    lexer = &l;
+    arena = &a;
+    current = l.pull();
+}
+
+
+//метки узлов без текста - имена тегов, общие для всех деревьев
+const std::string *Node::tag_label(Tag t) {
+    static const auto labels = []() {
+        std::array<std::string, PMATRIX + 1> res;
+        for (size_t i = 0; i < res.size(); ++i) {
+            res[i] = t_info[i].name;
+        }
+        return res;
+    }();
+    return &labels[t];
 }
 
+Node::Node(Arena &a) : _label(tag_label(ERROR)), fields(a.resource()) {}
+
+Node *Node::make(Arena &a) {
+    return new (a.allocate(sizeof(Node), alignof(Node))) Node(a);
+}
 
-Node::Node() = default;
+Node *Node::make(Arena &a, Token *t) {
+    return new (a.allocate(sizeof(Node), alignof(Node))) Node(a, t);
+}
 
-Node::Node(const Node &n) : _coord(n._coord), _tag(n._tag), _label(n._label), _priority(n._priority) {
-    if (n.left) left = new Node(*n.left);
-    if (n.right) right = new Node(*n.right);
-    if (n.cond) cond = new Node(*n.cond);
-    for (auto field : n.fields) {
-        fields.push_back(new Node(*field));
+Node *Node::copy(Arena &a) const {
+    Node *res = make(a);
+    res->_offset = _offset;
+    res->_tag = _tag;
+    res->_label = (_label == tag_label(_tag)) ? _label : a.intern(*_label);
+    res->_priority = _priority;
+    res->_number = _number;
+    res->_builtin = _builtin;
+    res->_dimension = _dimension;
+    res->_global = _global;
+    if (_numbers) res->_numbers = a.keep(*_numbers);
+    if (left) res->left = left->copy(a);
+    if (right) res->right = right->copy(a);
+    if (cond) res->cond = cond->copy(a);
+    res->fields.reserve(fields.size());
+    for (auto field : fields) {
+        res->fields.push_back(field->copy(a));
     }
+    return res;
 }
 
-Node::~Node() {
-    delete left;
-    delete right;
-    delete cond;
-    for (auto & field : fields) {
-        delete field;
+void Node::resolve_names() {
+    if (_tag == IDENT || _tag == FUNC || _tag == GRAPHIC || _tag == SUM || _tag == PRODUCT) {
+        _global = GlobalTable::slot(*_label);
+    }
+    if (left) left->resolve_names();
+    if (right) right->resolve_names();
+    if (cond) cond->resolve_names();
+    for (auto field : fields) {
+        field->resolve_names();
     }
 }
 
-void Node::print(const std::string& pref) const {
-    std::string img = t_info[_tag].name + ((_label.empty()) ? "" : "(" + _label + ")");
-    printf("%s Node: %s, %d\n", pref.c_str(), img.c_str(), _priority);
+//вложенные объявления тоже просматриваются: их захват берет значения из кадра и захвата внешней функции
+void Node::referenced(std::vector<int>& names) const {
+    if (_tag == IDENT || _tag == FUNC || _tag == GRAPHIC) {
+        names.push_back(_global);
+    }
+    if (left) left->referenced(names);
+    if (right) right->referenced(names);
+    if (cond) cond->referenced(names);
+    for (auto field : fields) {
+        field->referenced(names);
+    }
+}
 
-    if (left) {
-        left->print(pref + "l");
+//имена, которым присваивает тело функции, и счетчики \sum и \prod получают ячейки кадра после аргументов.
+//тело вложенного объявления не просматривается: у той функции свой кадр
+void Node::declare(std::vector<std::string>& slots) const {
+    auto add = [&slots](const std::string& name) {
+        if (std::find(slots.begin(), slots.end(), name) == slots.end()) slots.push_back(name);
+    };
+    if (_tag == SET && left && (left->_tag == IDENT || left->_tag == FUNC)) {
+        add(*left->_label);
+        if (left->_tag == FUNC) return;
     }
-    if (right) {
-        right->print(pref + "r");
+    if (_tag == SUM || _tag == PRODUCT) {
+        add(*_label);
     }
-    if (cond) {
-        cond->print(pref + "c");
+    if (left) left->declare(slots);
+    if (right) right->declare(slots);
+    if (cond) cond->declare(slots);
+    for (auto field : fields) {
+        field->declare(slots);
     }
+}
 
-    size_t n = fields.size();
-    for (size_t i = 0; i < n; i++) {
-        fields[i]->print(pref + "[" + std::to_string(i) + "]");
+void Node::bind(const std::vector<std::string>& slots) {
+    if (_tag == IDENT || _tag == FUNC || _tag == GRAPHIC || _tag == SUM || _tag == PRODUCT) {
+        auto it = std::find(slots.begin(), slots.end(), *_label);
+        _slot = (it == slots.end()) ? -1 : static_cast<int>(it - slots.begin());
+    }
+    if (_tag == SET && left && left->_tag == FUNC) {    //имя вложенной функции - ячейка, ее аргументы и тело - нет
+        left->_slot = static_cast<int>(std::find(slots.begin(), slots.end(), *left->_label) - slots.begin());
+        return;
     }
+    if (left) left->bind(slots);
+    if (right) right->bind(slots);
+    if (cond) cond->bind(slots);
+    for (auto field : fields) {
+        field->bind(slots);
+    }
+}
+
+void Node::bind_slots(std::vector<std::string>& slots) {
+    declare(slots);
+    bind(slots);
+}
+
+template <class Ref>
+void print_tree(Ref n, const std::string& pref) {
+    std::string img = t_info[n.tag()].name + ((n.label().empty()) ? "" : "(" + n.label() + ")");
+    printf("%s Node: %s, %d\n", pref.c_str(), img.c_str(), n.priority());
+
+    if (n.left()) {
+        print_tree(n.left(), pref + "l");
+    }
+    if (n.right()) {
+        print_tree(n.right(), pref + "r");
+    }
+    if (n.cond()) {
+        print_tree(n.cond(), pref + "c");
+    }
+
+    size_t sz = n.size();
+    for (size_t i = 0; i < sz; i++) {
+        print_tree(n.field(i), pref + "[" + std::to_string(i) + "]");
+    }
+}
+
+template void print_tree(NodeRef, const std::string&);
+template void print_tree(FlatTree::Ref, const std::string&);
+
+void Node::print(const std::string& pref) const {
+    print_tree(NodeRef{const_cast<Node *>(this)}, pref);
 }
 
 void Node::set_tag(Tag t) {
     _tag = t;
-    _label = t_info[_tag].name;
+    _label = tag_label(_tag);
     _priority = t_info[_tag].priority;
 }
 
@@ -79,12 +188,86 @@ Tag& Node::get_tag() {
     return _tag;
 }
 
-std::string& Node::get_label() {
-    return _label;
+const std::string& Node::get_label() const {
+    return *_label;
 }
 
-std::string& Node::toString() {
-    return _label;
+const std::string& Node::toString() const {
+    return *_label;
+}
+
+size_t Node::offset() const {
+    return _offset;
+}
+
+const std::array<int, 7>& Node::dimension() const {
+    return *_dimension;
+}
+
+const NumericMatrix& Node::numbers() const {
+    return **_numbers;
+}
+
+double Node::number() const {
+    return _number;
+}
+
+void Node::resolve() {
+    _number = (_tag == NUMBER) ? std::stod(*_label) : 0;
+    _builtin = (_tag == KEYWORD) ? builtins.find(*_label) : nullptr;
+    _dimension = (_tag == DIMENSION) ? dimensions.find(*_label) : nullptr;
+}
+
+void Node::save(std::string& out) const {
+    put_u64(out, _tag);
+    put_str(out, *_label);
+    put_u64(out, static_cast<uint64_t>(_priority));
+    put_u64(out, _offset);
+    out += static_cast<char>((left ? 1 : 0) | (right ? 2 : 0) | (cond ? 4 : 0) | (_numbers ? 8 : 0));
+    if (_numbers) {
+        put_u64(out, numbers().rows);
+        put_u64(out, numbers().cols);
+        for (double d : numbers().data) put_f64(out, d);
+    }
+    put_u64(out, fields.size());
+    if (left) left->save(out);
+    if (right) right->save(out);
+    if (cond) cond->save(out);
+    for (auto field : fields) {
+        field->save(out);
+    }
+}
+
+//при ошибке чтения недостроенное дерево остается в арене и освобождается вместе с ней
+Node *Node::load(Reader& in, Arena& a) {
+    Node *res = make(a);
+    uint64_t tag = in.u64();
+    if (tag > PMATRIX) throw std::runtime_error("Corrupted cache entry");
+    res->_tag = static_cast<Tag>(tag);
+    res->_label = a.intern(in.str());
+    res->_priority = static_cast<int>(in.u64());
+    res->_offset = in.u64();
+    res->resolve();
+    in.need(1);
+    char mask = *in.p++;
+    if (mask & 8) {
+        auto m = std::make_shared<NumericMatrix>();
+        m->rows = in.u64();
+        m->cols = in.u64();
+        size_t room = static_cast<size_t>(in.end - in.p) / sizeof(double);
+        if (m->cols != 0 && m->rows > room / m->cols) throw std::runtime_error("Corrupted cache entry");
+        m->data.resize(m->rows * m->cols);
+        for (double& d : m->data) d = in.f64();
+        res->_numbers = a.keep(std::move(m));
+    }
+    uint64_t n = in.u64();
+    if (mask & 1) res->left = load(in, a);
+    if (mask & 2) res->right = load(in, a);
+    if (mask & 4) res->cond = load(in, a);
+    for (uint64_t i = 0; i < n; ++i) {
+        res->fields.push_back(load(in, a));
+    }
+    return res;
 }
 
 Node *Parser::expression(int pr) {  //выражение
@@ -99,10 +282,13 @@ Node *Parser::expression(int pr) {  //выражение
     return lhs;
 }
 
-std::vector<Node *> Parser::block(Tag stop) {   //блок
-    std::vector<Node *> block;
+std::pmr::vector<Node *> Parser::block(Tag stop) {   //блок
+    std::pmr::vector<Node *> block(arena->resource());
 
     while (cur()->_tag != stop) {
+        if (cur()->_tag == NONE) {
+            throw Error(cur()->at(), "Unexpected end of block");
+        }
         if (cur()->_tag == BREAK) {
             get();
             continue;
@@ -112,12 +298,12 @@ std::vector<Node *> Parser::block(Tag stop) {   //блок
     return block;
 }
 
-std::vector<Node *> Parser::line() {
-    std::vector<Node *> res;
+std::pmr::vector<Node *> Parser::line() {
+    std::pmr::vector<Node *> res(arena->resource());
     Tag ctag = cur()->_tag;
 
     if (ctag == AMP || ctag == BREAK || ctag == ENDM) {
-        throw Error(cur()->start.start, "Bad matrix");
+        throw Error(cur()->at(), "Bad matrix");
     }
     res.push_back(expression(0));
     while (cur()->_tag == AMP) {
@@ -127,37 +313,34 @@ std::vector<Node *> Parser::line() {
     return res;
 }
 
-std::vector<Node *> Parser::matrix() {
-    std::vector<Node *> res;
-    Node *row = new Node();
+std::pmr::vector<Node *> Parser::matrix() {
+    std::pmr::vector<Node *> res(arena->resource());
+    Node *row = Node::make(*arena);
     row->set_tag(LIST);
-    row->_coord = cur()->start.start;
+    row->_offset = cur()->at();
     row->fields = line();
     res.push_back(row);
     size_t N = row->fields.size();
     while (cur()->_tag == BREAK) {
         get();
-        row = new Node();
+        row = Node::make(*arena);
         row->set_tag(LIST);
-        row->_coord = cur()->start.start;
+        row->_offset = cur()->at();
         row->fields = line();
         res.push_back(row);
         if (N != row->fields.size()) {
-            for (auto it = row->fields.begin(); it != row->fields.end(); ++it) {
-                delete *it;
-                throw Error(row->_coord, "Matrix is not rectangular");
-            }
+            throw Error(row->_offset, "Matrix is not rectangular");
         }
     }
     return res;
 }
 
-std::vector<Node *> Parser::cases() {
-    std::vector<Node *> res;
+std::pmr::vector<Node *> Parser::cases() {
+    std::pmr::vector<Node *> res(arena->resource());
     do {
-        Node *alt = new Node();
+        Node *alt = Node::make(*arena);
         alt->set_tag(ALT);
-        alt->_coord = cur()->start.start;
+        alt->_offset = cur()->at();
         alt->right = expression(0);
 
         Tag t = get()->_tag;    // тег должен быть WHEN или OTHERWISE
@@ -165,11 +348,7 @@ std::vector<Node *> Parser::cases() {
             alt->cond = expression(0);
         }
         else if (t != OTHERWISE) {
-            delete alt;
-            for (auto & re : res) {
-                delete re;
-            }
-            throw Error(cur()->start.start, "Unexpected symbol - expected \\when or \\otherwise");
+            throw Error(cur()->at(), "Unexpected symbol - expected \\when or \\otherwise");
         }
         res.push_back(alt);
 
@@ -182,8 +361,8 @@ std::vector<Node *> Parser::cases() {
     return res;
 }
 
-std::vector<Node *> Parser::list(Tag close) {  //список аргументов
-    std::vector<Node *> res;
+std::pmr::vector<Node *> Parser::list(Tag close) {  //список аргументов
+    std::pmr::vector<Node *> res(arena->resource());
     Tag next = Parser::next()->_tag;   //скипнуть (, перейти на следующий токен
     if (next == close) {            //пустой список, скипнуть )
         get();
@@ -194,10 +373,7 @@ std::vector<Node *> Parser::list(Tag close) {  //список аргументо
             next = get()->_tag;             //если запятая, то продолжить цикл
         } while (next == COMMA);
         if (next != close) {               //если выход не на ), то это ошибка
-            for (auto & re : res) {
-                delete re;
-            }
-            throw Error(cur()->start.start, "List not closed");
+            throw Error(cur()->at(), "List not closed");
         }
     }
     return res;
@@ -205,7 +381,7 @@ std::vector<Node *> Parser::list(Tag close) {  //список аргументо
 
 Node *Parser::binexpr(Token *rhs, Node *lhs) {
     rhs->binary();
-    Node *res = new Node(rhs);
+    Node *res = Node::make(*arena, rhs);
 
     Tag close_tag = t_info[res->_tag].close_tag;
 
@@ -216,8 +392,7 @@ Node *Parser::binexpr(Token *rhs, Node *lhs) {
 
     if (close_tag) {    //это вообще когда-нибудь срабатывает?
         if (!skip(close_tag)) {
-            delete res;
-            throw Error(cur()->start.start, "Unexpected symbol");
+            throw Error(cur()->at(), "Unexpected symbol");
         }
     }
 
@@ -226,7 +401,7 @@ Node *Parser::binexpr(Token *rhs, Node *lhs) {
 
 Node *Parser::unexpr(Token *t) {
     t->unary();
-    Node *res = new Node(t);
+    Node *res = Node::make(*arena, t);
     Tag close_tag = t_info[res->_tag].close_tag;
 
     // если это выражение в скобках
@@ -240,13 +415,14 @@ Node *Parser::unexpr(Token *t) {
         else if (res->_tag == BEGINM) {
             res->fields = matrix();
         }
+        else if (res->_tag == SUM || res->_tag == PRODUCT) {   //\sum_{k=a}^{b} тело
+            series(res);
+        }
         else {    //выражение в простых скобках
-            delete res;
             res = expression(0);
         }
         if (!skip(close_tag)) {
-            delete res;
-            throw Error(cur()->start.start, "Unexpected symbol - expected close_tag");
+            throw Error(cur()->at(), "Unexpected symbol - expected close_tag");
         }
     }
     else if (res->_tag == IDENT) {
@@ -255,7 +431,7 @@ Node *Parser::unexpr(Token *t) {
             if (cur()->_tag == LBRACE) { //составной индекс: x_{1+2+3}, y_{q,w}
                 res->fields = list(RBRACE);
                 if (res->fields.size() < 1 || res->fields.size() > 2) {
-                    throw Error(res->_coord, "Bad index");
+                    throw Error(res->_offset, "Bad index");
                 }
             }
             else {  //простой индекс: x_1, y_z
@@ -267,6 +443,9 @@ Node *Parser::unexpr(Token *t) {
             res->fields = list(RPAREN);
         }
     }
+    else if (res->_tag == PMATRIX) {
+        res->_numbers = arena->keep(lexer->literal(t->offset));
+    }
     else if (res->_tag == KEYWORD) {
         if (cur()->_tag == LPAREN) {
             res->fields = list(RPAREN); //тег ключевого слова не надо менять на тег функции
@@ -304,7 +483,7 @@ Node *Parser::unexpr(Token *t) {
             res->left = expression(0);
         }
     }
-    else if (res->_tag == WHILE || res->_tag == PRODUCT) {
+    else if (res->_tag == WHILE) {
         res->cond = expression(0);
         if (cur()->_tag == BREAK) {
             get();
@@ -313,22 +492,20 @@ Node *Parser::unexpr(Token *t) {
     }
         //\newcommand{\graphic}[3]
     else if (res->_tag == GRAPHIC) {
-        delete res;
         Node *tmp = arg(LBRACE);	//имя функции
         if (tmp->_tag != IDENT) {
-            throw Error(tmp->_coord, "Expected identifier");
+            throw Error(tmp->_offset, "Expected identifier");
         }
         res = tmp;
         res->_tag = GRAPHIC;
         if (cur()->_tag != LBRACE) {
-            delete res;
-            throw Error(cur()->start.start, "Expected argument");
+            throw Error(cur()->at(), "Expected argument");
         }
         res->fields = list(RBRACE);	//поля
-        size_t a = cur()->start.index;
+        size_t a = cur()->offset;
         Parser::wait(RBRACE);				//точки графика парсить не нужно
-        size_t b = cur()->start.index;
-        Node::save_rep(res->_coord, GRAPHIC, a, b);
+        size_t b = cur()->offset;
+        Node::save_rep(res->_offset, GRAPHIC, a, b);
     }
     else if (t_info[res->_tag].is_operator) {
         res->right = expression(res->_priority);
@@ -336,10 +513,28 @@ Node *Parser::unexpr(Token *t) {
     return res;
 }
 
+//\sum_{k=a}^{b} тело: счетчик - в _label, нижний предел - в left, верхний - в cond, тело - в right
+void Parser::series(Node *res) {
+    if (!skip(INDEX)) {
+        throw Error(cur()->at(), "Expected _{...}");
+    }
+    Node *from = arg(LBRACE);
+    if (from->_tag != EQ || from->left->_tag != IDENT || !from->left->fields.empty()) {
+        throw Error(from->_offset, "Expected {counter = lower bound}");
+    }
+    res->_label = from->left->_label;
+    res->left = from->right;
+    if (!skip(POW)) {
+        throw Error(cur()->at(), "Expected ^{...}");
+    }
+    res->cond = arg(LBRACE);
+    res->right = expression(0);
+}
+
 //читает аргумент в скобках
 Node* Parser::arg(Tag open) {
     if (cur()->_tag != open) {
-        throw Error(cur()->start.start, "Expected argument");
+        throw Error(cur()->at(), "Expected argument");
     }
     return expression(666);
 }
@@ -1,15 +1,23 @@
 #pragma once
 
 #include "Coordinate.h"
+#include "Arena.h"
 
 
 class Value;
 
+struct Reader;
+
 class Node;
 
+class Lexer;
+
+//парсер забирает токены у лексера по одному, целиком блок токенов не хранится
 typedef struct Parser {
-	std::vector<Token> program;
-	int i = 0;
+	Lexer *lexer = nullptr;
+	Arena *arena = nullptr;     //узлы блока
+	Token current;      //текущий токен
+	Token taken;        //токен, отданный get(): действителен до следующего get()
 
 	Token *next();
 
@@ -19,7 +27,7 @@ typedef struct Parser {
 
 	bool skip(Tag);
 
-	void init(std::vector<Token> &);
+	void init(Lexer &l, Arena &a);     //лексер уже начал блок (Lexer::start)
 
 	Node *unexpr(Token *);
 
@@ -27,55 +35,93 @@ typedef struct Parser {
 
 	Node *expression(int = 0);
 
-	std::vector<Node *> block(Tag = NONE);
+	std::pmr::vector<Node *> block(Tag = NONE);
 
-	std::vector<Node *> line();
+	std::pmr::vector<Node *> line();
 
-	std::vector<Node *> cases();
+	std::pmr::vector<Node *> cases();
 
-	std::vector<Node *> list(Tag close);
+	std::pmr::vector<Node *> list(Tag close);
 
-	std::vector<Node *> matrix();
+	std::pmr::vector<Node *> matrix();
 
 	Node * arg(Tag open);
 
+	void series(Node *);
+
 	void wait(Tag stop);
 } Parser;
 
 
 typedef std::map<std::string, Value> name_table;
 
+struct Scope;       //имена вызова функции (Frame.h); nullptr - глобальная область
+
+class GlobalTable;  //глобальные переменные по номерам (Value.h)
+
+struct Func;
+
 
 struct Replacement;
 
+struct Op;
 
-typedef std::map<Coordinate, Replacement> replacement_map;
+
+typedef std::map<size_t, Replacement> replacement_map;   //ключ - смещение узла во входном файле
 
 
 class Node {
 	friend struct Parser;
+	friend struct NodeRef;
+	friend class FlatTree;
 
-	Coordinate _coord;
+	size_t _offset = 0;    //смещение во входном файле
 	Tag _tag = ERROR;
-	std::string _label;
+	const std::string *_label;                         //строка в арене дерева или имя тега
 	int _priority = 0;
+	double _number = 0;                                //NUMBER: значение, _label разбирается один раз
+	const Builtin *_builtin = nullptr;                 //KEYWORD: встроенная функция или константа
+	const std::array<int, 7> *_dimension = nullptr;    //DIMENSION: размерность единицы
+	const std::shared_ptr<const NumericMatrix> *_numbers = nullptr;    //PMATRIX: числа, ими владеет арена
+	int _slot = -1;                                    //имя в теле функции: номер ячейки кадра вызова
+	int _global = -1;                                  //имя: номер глобальной переменной (resolve_names)
+
+	static const std::string *tag_label(Tag t);
+
+	void resolve();     //найти _number, _builtin или _dimension по _label один раз, а не при каждом исполнении
+
+	bool compile(std::vector<Op>& code, const std::string& counter, Scope *scope) const;
+
+	void declare(std::vector<std::string>& slots) const;
+
+	void bind(const std::vector<std::string>& slots);
 public:
-	static name_table global;
-	static replacement_map reps;
+	static thread_local GlobalTable global;     //состояние интерпретатора у каждого потока свое
+	static thread_local replacement_map reps;
 	Node *left = nullptr;
 	Node *right = nullptr;
 	Node *cond = nullptr;
-	std::vector<Node *> fields;
+	std::pmr::vector<Node *> fields;    //память списка - в той же арене
 
-	Node();
+	explicit Node(Arena &a);
 
-	Node(const Node &n);
+	Node(Arena &a, Token *t);
 
-	Node(Token *t);
+	Node(const Node &n) = delete;
 
-	static void save_rep(const Coordinate&, Tag, size_t, size_t);
+	static Node *make(Arena &a);    //узел в арене; освобождается вместе с ней
 
-	virtual ~Node();
+	static Node *make(Arena &a, Token *t);
+
+	Node *copy(Arena &a) const;     //дерево целиком в другую арену: тело функции переживает блок
+
+	void resolve_names();   //после разбора блока: имена переменных и функций получают глобальные номера
+
+	void referenced(std::vector<int>& names) const;     //глобальные номера имен, которые читает дерево
+
+	void bind_slots(std::vector<std::string>& slots);    //тело функции: slots - аргументы, дополняется локальными
+
+	static void save_rep(size_t, Tag, size_t, size_t);
 
 	void print(const std::string& pref) const;
 
@@ -83,17 +129,84 @@ public:
 
     Tag& get_tag();
 
-    std::string& get_label();
+    const std::string& get_label() const;
+
+    const std::string& toString() const;
+
+    size_t offset() const;
+
+    const std::array<int, 7>& dimension() const;
+
+    const NumericMatrix& numbers() const;
+
+    double number() const;
+
+    void save(std::string& out) const;
+
+    static Node *load(Reader& in, Arena& a);
 
-    std::string& toString();
+	Value exec(Scope *scope);
 
-	Value exec(name_table *nt);
+	Value series(Scope *scope);    //\sum и \prod (Series.cpp): тело исполняется по дереву в любой раскладке
 
-	static void copy_defs(name_table &local, name_table *ptr);
+	static void capture(Func &f, Scope *ptr);     //значения f.free в месте объявления
 
-	static Value &lookup(const std::string& name, name_table *ptr, const Coordinate&);
+	//slot - ячейка кадра для имени из тела функции, -1 - имя не локальное; gslot - глобальный номер имени
+	static const Value *find(int slot, int gslot, Scope *ptr);     //nullptr - имени нет
 
-	static void def(const std::string& name, const Value&, name_table *ptr);
+	static const Value &lookup(int slot, int gslot, Scope *ptr, size_t);
+
+	static Value &writable(int slot, int gslot, Scope *ptr, size_t);   //для присваивания по индексу
+
+	static void def(int slot, int gslot, const Value&, Scope *ptr);
 
     void semantic_analysis();
-};
\ No newline at end of file
+};
+
+
+//обходы дерева (исполнение, анализ, печать) написаны один раз для ссылки на узел:
+//NodeRef - узел в указателях, FlatTree::Ref (Flat.h) - индекс в массивах, набор вызовов у них одинаковый
+typedef struct NodeRef {
+    Node *p = nullptr;
+
+    explicit operator bool() const { return p != nullptr; }
+
+    Tag tag() const { return p->_tag; }
+
+    NodeRef left() const { return {p->left}; }
+
+    NodeRef right() const { return {p->right}; }
+
+    NodeRef cond() const { return {p->cond}; }
+
+    size_t size() const { return p->fields.size(); }
+
+    NodeRef field(size_t i) const { return {p->fields[i]}; }
+
+    const std::string& label() const { return *p->_label; }
+
+    int slot() const { return p->_slot; }
+
+    int global() const { return p->_global; }
+
+    int priority() const { return p->_priority; }
+
+    size_t offset() const { return p->_offset; }
+
+    double number() const { return p->_number; }
+
+    const Builtin *builtin() const { return p->_builtin; }
+
+    const std::array<int, 7>& dimension() const { return *p->_dimension; }
+
+    const NumericMatrix& numbers() const { return **p->_numbers; }
+
+    Node *node() const { return p; }     //тело функции копируется и \sum исполняется по дереву
+} NodeRef;
+
+
+template <class Ref>
+Value evaluate(Ref n, Scope *scope);       //Value.cpp
+
+template <class Ref>
+void print_tree(Ref n, const std::string& pref);    //Node.cpp
@@ -0,0 +1,74 @@
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "Perf.h"
+
+
+static int open_counter(uint32_t type, uint64_t config) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+static uint64_t read_counter(int fd) {
+    uint64_t value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return value;
+}
+
+CacheCounters::CacheCounters() {
+    misses_fd_ = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    if (misses_fd_ < 0) {
+        error_ = std::string("perf_event_open: ") + std::strerror(errno);
+        return;
+    }
+    l1d_fd_ = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                               (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+CacheCounters::~CacheCounters() {
+    if (misses_fd_ >= 0) close(misses_fd_);
+    if (l1d_fd_ >= 0) close(l1d_fd_);
+}
+
+bool CacheCounters::available() const {
+    return misses_fd_ >= 0;
+}
+
+const std::string& CacheCounters::error() const {
+    return error_;
+}
+
+void CacheCounters::start() {
+    for (int fd : {misses_fd_, l1d_fd_}) {
+        if (fd < 0) continue;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void CacheCounters::stop() {
+    for (int fd : {misses_fd_, l1d_fd_}) {
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+}
+
+uint64_t CacheCounters::misses() const {
+    return read_counter(misses_fd_);
+}
+
+uint64_t CacheCounters::l1d_misses() const {
+    return read_counter(l1d_fd_);
+}
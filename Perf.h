@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+
+//промахи кэша текущего потока по счетчикам процессора (perf_event_open, только пользовательский код).
+//если ядро или виртуальная машина счетчиков не дает, available() == false, а error() - причина
+class CacheCounters {
+public:
+    CacheCounters();
+
+    ~CacheCounters();
+
+    CacheCounters(const CacheCounters&) = delete;
+    CacheCounters& operator=(const CacheCounters&) = delete;
+
+    bool available() const;
+
+    const std::string& error() const;
+
+    void start();   //счет с нуля
+
+    void stop();
+
+    uint64_t misses() const;        //промахи последнего уровня (cache-misses)
+
+    uint64_t l1d_misses() const;    //промахи чтения L1 данных
+
+private:
+    int misses_fd_ = -1;
+    int l1d_fd_ = -1;
+    std::string error_;
+};
@@ -0,0 +1,168 @@
+#include <iostream>
+#include <iomanip>
+#include <exception>
+#include <functional>
+
+#include "Pipeline.h"
+#include "Preprocessor.h"
+#include "FileHandler.h"
+#include "Value.h"
+#include "basic_HM.h"
+
+
+typedef std::chrono::steady_clock::duration Duration;
+
+//блок на пути по конвейеру; nullptr в очереди - конец файла
+typedef struct Item {
+    ProgramString ps;
+    Arena arena;            //дерево блока: строится стадией разбора, освобождается с Item
+    Node *root = nullptr;
+    replacement_map reps;
+    std::string replacement;
+    std::exception_ptr error;
+} Item;
+
+typedef SpscQueue<Item *> Queue;
+
+static double ms(Duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+//промежуточная стадия: после первой ошибки блоки только передаются дальше,
+//состояние стадии (Node::global, таблицы анализатора) у каждого потока свое
+static void run_stage(Queue& in, Queue& out, Duration& busy, const std::function<void(Item *)>& work) {
+    bool failed = false;
+    for (;;) {
+        Item *it = in.pop();
+        if (!it) break;
+        if (it->error) failed = true;
+        if (!failed) {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                work(it);
+            }
+            catch (...) {
+                it->error = std::current_exception();
+                failed = true;
+            }
+            busy += std::chrono::steady_clock::now() - start;
+        }
+        out.push(it);
+    }
+    out.push(nullptr);
+}
+
+static void report(const char *file, const Duration busy[], Queue *queues[]) {
+    static const char *stages[] = {"read", "parse", "analyse", "exec", "write"};
+    static const char *links[] = {"read->parse", "parse->analyse", "analyse->exec", "exec->write"};
+    std::cerr << file << ": pipeline" << std::endl;
+    std::cerr << std::fixed << std::setprecision(2);
+    std::cerr << "  stage      busy ms  wait in ms  wait out ms" << std::endl;
+    for (int i = 0; i < 5; ++i) {
+        std::cerr << "  " << std::left << std::setw(9) << stages[i] << std::right
+                  << std::setw(9) << ms(busy[i])
+                  << std::setw(12) << (i > 0 ? ms(queues[i - 1]->pop_stall) : 0.0)
+                  << std::setw(13) << (i < 4 ? ms(queues[i]->push_stall) : 0.0) << std::endl;
+    }
+    std::cerr << "  queue           capacity  max depth  avg depth" << std::endl;
+    for (int i = 0; i < 4; ++i) {
+        Queue *q = queues[i];
+        std::cerr << "  " << std::left << std::setw(15) << links[i] << std::right
+                  << std::setw(9) << q->capacity()
+                  << std::setw(11) << q->max_depth
+                  << std::setw(11) << (q->pushes ? static_cast<double>(q->depth_sum) / q->pushes : 0.0) << std::endl;
+    }
+    std::cerr.unsetf(std::ios::floatfield);
+}
+
+bool process_file_pipelined(const char *file_in, const char *file_out, bool replace, size_t depth) {
+    FileHandler out(file_in, file_out);
+    if (!out.good()) {
+        std::cerr << file_in << ":" << "Failed to initialize" << std::endl;
+        out.remove_out();
+        return false;
+    }
+
+    Queue scanned(depth), parsed(depth), analysed(depth), executed(depth);
+    Queue *queues[] = {&scanned, &parsed, &analysed, &executed};
+    Duration busy[5] = {};
+    std::atomic<bool> stop{false};
+
+    //чтение: только поиск блоков, текст вне блоков копирует стадия записи
+    std::thread reader([&]() {
+        FileHandler fh(file_in, nullptr);
+        while (!stop.load(std::memory_order_relaxed)) {
+            auto start = std::chrono::steady_clock::now();
+            ProgramString ps = fh.next();
+            busy[0] += std::chrono::steady_clock::now() - start;
+            if (ps.program.empty()) break;
+            Item *it = new Item();
+            it->ps = std::move(ps);
+            scanned.push(it);
+        }
+        scanned.push(nullptr);
+    });
+    std::thread parser([&]() {
+        Position::lines.reset(out.text());  //ошибки форматируются в потоке, который их бросил
+        run_stage(scanned, parsed, busy[1], [](Item *it) {
+            Node::reps.clear();
+            it->root = parse_block(it->ps, it->arena);
+            it->reps = std::move(Node::reps);
+            Node::reps.clear();
+        });
+    });
+    std::thread analyser([&]() {
+        Position::lines.reset(out.text());
+        reset_analysis();
+        run_stage(parsed, analysed, busy[2], [](Item *it) {
+            it->root->semantic_analysis();
+        });
+    });
+    std::thread executor([&]() {
+        Position::lines.reset(out.text());
+        Node::global.clear();
+        run_stage(analysed, executed, busy[3], [](Item *it) {
+            Node::reps = std::move(it->reps);
+            it->root->exec({});
+            it->replacement = make_replacement(it->ps.program, Node::reps);
+            Node::reps.clear();
+        });
+    });
+
+    //запись в этом потоке: сообщение об ошибке выводится в порядке блоков
+    bool ok = true;
+    size_t done = 0;    //до какого смещения входной файл уже выведен
+    for (;;) {
+        Item *it = executed.pop();
+        if (!it) break;
+        auto start = std::chrono::steady_clock::now();
+        if (ok && it->error) {
+            ok = run_reported(file_in, [&]() { std::rethrow_exception(it->error); });
+            stop = true;
+        }
+        if (ok) {
+            out.write_out(done, it->ps.offset);
+            out.print_to_out(it->replacement);
+            done = std::min(it->ps.offset + it->ps.length, out.input_size());
+        }
+        delete it;
+        busy[4] += std::chrono::steady_clock::now() - start;
+    }
+    reader.join();
+    parser.join();
+    analyser.join();
+    executor.join();
+
+    if (ok) {
+        out.write_out(done, out.input_size());
+        if (replace) {
+            ok = !out.replace_files();
+        } else if (!out.finish()) {
+            ok = false;
+        }
+    } else {
+        out.remove_out();
+    }
+    report(file_in, busy, queues);
+    return ok;
+}
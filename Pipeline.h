@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+
+//ограниченная очередь без блокировок для одного производителя и одного потребителя.
+//при пустой/полной очереди поток крутится, потом уступает процессор, потом засыпает
+//(иначе ожидающие стадии отнимают время у работающей, если ядер меньше, чем стадий); время ожидания
+//и заполненность очереди копятся в счетчиках (их читают после завершения потоков)
+template<class T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n *= 2;
+        ring_.resize(n);
+        mask_ = n - 1;
+    }
+
+    size_t capacity() const {
+        return ring_.size();
+    }
+
+    void push(T v) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_) {
+            auto start = std::chrono::steady_clock::now();
+            for (int spins = 0; tail - head_.load(std::memory_order_acquire) > mask_; ++spins) {
+                backoff(spins);
+            }
+            push_stall += std::chrono::steady_clock::now() - start;
+        }
+        ring_[tail & mask_] = std::move(v);
+        tail_.store(tail + 1, std::memory_order_release);
+
+        size_t depth = tail + 1 - head_.load(std::memory_order_relaxed);
+        if (depth > max_depth) max_depth = depth;
+        depth_sum += depth;
+        ++pushes;
+    }
+
+    T pop() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            auto start = std::chrono::steady_clock::now();
+            for (int spins = 0; head == tail_.load(std::memory_order_acquire); ++spins) {
+                backoff(spins);
+            }
+            pop_stall += std::chrono::steady_clock::now() - start;
+        }
+        T v = std::move(ring_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return v;
+    }
+
+    //со стороны производителя
+    std::chrono::steady_clock::duration push_stall{0};
+    size_t max_depth = 0;
+    size_t depth_sum = 0;
+    size_t pushes = 0;
+    //со стороны потребителя
+    std::chrono::steady_clock::duration pop_stall{0};
+
+private:
+    static void backoff(int spins) {
+        if (spins < 64) return;
+        if (spins < 128) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    std::vector<T> ring_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+//обработка файла конвейером: чтение -> лексический и синтаксический анализ -> анализ размерностей ->
+//исполнение -> запись, каждая стадия в своем потоке. Блоки исполняются строго по порядку
+bool process_file_pipelined(const char *file_in, const char *file_out, bool replace, size_t depth = 64);
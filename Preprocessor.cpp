@@ -0,0 +1,213 @@
+#include <iostream>
+#include <algorithm>
+
+#include "Preprocessor.h"
+#include "FileHandler.h"
+#include "Lexer.h"
+#include "Value.h"
+#include "basic_HM.h"
+
+
+std::string make_replacement(std::string_view prog, const replacement_map& m) {
+	std::string res;
+	size_t index = 0;
+
+//	std::cout << "make_replacement.size = " << m.size() << std::endl;
+
+	for (auto& it : m) {
+		res += prog.substr(index, it.second.begin - index);
+		if (it.second.tag == GRAPHIC) {
+			res += "{" + to_plot(it.second.replacement) + "}";
+		}
+		else {
+//		    std::cout << "second.replacement = " << to_string((*it).second.replacement) << std::endl;
+			res += "{" + to_string(it.second.replacement) + "}";
+		}
+		index = it.second.end;
+	}
+	res += prog.substr(index);
+	return res;
+}
+
+//временный файл создается рядом с исходным: dir/_name
+std::string temp_name(const std::string& path) {
+	size_t slash = path.rfind('/');
+	if (slash == std::string::npos) {
+		return "_" + path;
+	}
+	return path.substr(0, slash + 1) + "_" + path.substr(slash + 1);
+}
+
+Node *parse_block(const ProgramString& ps, Arena& arena) {
+	Lexer l;
+	Parser B;
+	l.start(ps);
+	B.init(l, arena);
+	Node *res = Node::make(arena);
+	res->fields = B.block(NONE);
+	res->set_tag(ROOT);
+	res->resolve_names();
+//	res->print("");
+	return res;
+}
+
+std::string eval_block(Node *root, const ProgramString& ps) {
+    // Стадия семантического анализа для проверки корректности операций с размерными физическими величинами
+    root->semantic_analysis();
+
+	root->exec({});
+
+	std::string replacement = make_replacement(ps.program, Node::reps);
+	Node::reps.clear();
+	return replacement;
+}
+
+//смещения тела такой функции попадают в состояние интерпретатора,
+//поэтому результат блока нельзя переносить на другое место в файле
+bool defines_function(const ProgramString& ps) {
+	bool res = false;
+	Node::global.each([&](const std::string&, const Value& v) {
+		if (v._type != Value::FUNCTION) return;
+		size_t offset = v.get_function()->body->offset();
+		if (offset >= ps.offset && offset < ps.offset + ps.length) res = true;
+	});
+	return res;
+}
+
+bool run_reported(const char *file, const std::function<void()>& f, Failure *failure) {
+	try {
+		f();
+		return true;
+	}
+	catch (Error& err) {
+		if (failure) {
+			*failure = Failure{"error", err.message(), err.coord().line, err.coord().pos};
+			return false;
+		}
+	    std::cout << "catch (Error err)\n";
+		std::cerr << file << ":" << err.what() << std::endl;
+	}
+	catch (Value::BadType& err) {
+		if (failure) {
+			*failure = Failure{"bad_type", err.what()};
+			return false;
+		}
+        std::cout << "catch (Value::BadType err\n)";
+		std::cerr << file << ":" << err.what() << std::endl;
+	}
+	catch (std::exception& err) {
+		if (failure) {
+			*failure = Failure{"exception", err.what()};
+			return false;
+		}
+        std::cout << "catch (std::exception err)\n";
+		std::cerr << file << ":" << err.what() << std::endl;
+	}
+	return false;
+}
+
+//обработка одного файла, у каждого файла свое состояние интерпретатора
+bool process_file(const char *file_in, const char *file_out, bool replace, BlockCache *cache, Failure *failure) {
+	bool ok = true;
+
+	Node::global.clear();
+	Node::reps.clear();
+	reset_analysis();
+
+	FileHandler fh(file_in, file_out);
+	Position::lines.reset(fh.text());
+	if (!fh.good()) {
+		if (failure) {
+			*failure = Failure{"exception", "Failed to initialize"};
+		} else {
+			std::cerr << file_in << ":" << "Failed to initialize" << std::endl;
+		}
+		ok = false;
+	}
+
+	CachedEval ce(cache);
+	Arena arena;    //дерево текущего блока, после блока память освобождается целиком
+	while (ok) {
+		Position::ps = fh.next();
+        if (Position::ps.program.empty()) {
+            break;
+        }
+		ok = run_reported(file_in, [&]() {
+			fh.print_to_out(ce.eval(Position::ps, [&]() {
+				return eval_block(parse_block(Position::ps, arena), Position::ps);
+			}));
+		}, failure);
+		arena.reset();
+	}
+
+	if (ok) {                   //если удалось обработать файл и
+		if (replace) {          //если надо перезаписать файл
+			ok = !fh.replace_files();
+		} else if (!fh.finish()) {  //ошибка записи (например, закрытый канал stdout)
+			ok = false;
+		}
+	} else { //если не удалось обработать файл, то удалить выходной файл
+		fh.remove_out();
+	}
+	return ok;
+}
+
+//замены блока: между ними текст блока как диапазоны входного файла, без сборки строки
+static void write_replacement(FileHandler& fh, const ProgramString& ps, const replacement_map& m) {
+	size_t index = 0;
+	for (auto& it : m) {
+		fh.write_out(ps.offset + index, ps.offset + it.second.begin);
+		if (it.second.tag == GRAPHIC) {
+			fh.print_to_out("{" + to_plot(it.second.replacement) + "}");
+		}
+		else {
+			fh.print_to_out("{" + to_string(it.second.replacement) + "}");
+		}
+		index = it.second.end;
+	}
+	fh.write_out(ps.offset + index, std::min(ps.offset + ps.length, fh.input_size()));
+}
+
+bool process_file_streaming(const char *file_in, const char *file_out, bool replace, size_t window) {
+	bool ok = true;
+
+	Node::global.clear();
+	Node::reps.clear();
+	reset_analysis();
+
+	FileHandler fh(file_in, file_out);
+	Position::lines.reset(fh.text());
+	if (!fh.good()) {
+		std::cerr << file_in << ":" << "Failed to initialize" << std::endl;
+		ok = false;
+	}
+	fh.stream(window);
+
+	Arena arena;
+	while (ok) {
+		Position::ps = fh.next();
+		if (Position::ps.program.empty()) {
+			break;
+		}
+		ok = run_reported(file_in, [&]() {
+			Node *res = parse_block(Position::ps, arena);
+			res->semantic_analysis();
+			res->exec({});
+			write_replacement(fh, Position::ps, Node::reps);
+			Node::reps.clear();
+		});
+		arena.reset();
+	}
+	Position::ps = ProgramString();     //срез отображения не должен пережить файл
+
+	if (ok) {
+		if (replace) {
+			ok = !fh.replace_files();
+		} else if (!fh.finish()) {
+			ok = false;
+		}
+	} else {
+		fh.remove_out();
+	}
+	return ok;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <functional>
+
+#include "Coordinate.h"
+#include "Node.h"
+#include "Cache.h"
+
+
+std::string make_replacement(std::string_view prog, const replacement_map& m);
+
+std::string temp_name(const std::string& path);    //dir/name -> dir/_name
+
+Node *parse_block(const ProgramString& ps, Arena& arena);  //лексический и синтаксический анализ блока, дерево - в arena
+
+std::string eval_block(Node *root, const ProgramString& ps);    //анализ размерностей, исполнение, подстановка
+
+bool defines_function(const ProgramString& ps);    //есть ли в Node::global функция, тело которой из этого блока
+
+//описание ошибки для ответа сервера; line и column равны 0, если координат нет
+typedef struct Failure {
+    std::string kind;       //error, bad_type, exception
+    std::string message;
+    size_t line = 0;
+    size_t column = 0;
+} Failure;
+
+//false, если было исключение; если передан failure, ошибка записывается в него, а не в stderr
+bool run_reported(const char *file, const std::function<void()>& f, Failure *failure = nullptr);
+
+bool process_file(const char *file_in, const char *file_out, bool replace, BlockCache *cache = nullptr,
+                  Failure *failure = nullptr);
+
+//потоковая обработка: текст блоков не копируется, неизмененные части блока пишутся в вывод
+//диапазонами входного файла, память входа и вывода ограничена окном window байт
+bool process_file_streaming(const char *file_in, const char *file_out, bool replace, size_t window);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <functional>
+
+
+//двоичная запись состояния интерпретатора (для кэша блоков)
+inline void put_u64(std::string& out, uint64_t x) {
+    out.append(reinterpret_cast<const char *>(&x), sizeof(x));
+}
+
+inline void put_f64(std::string& out, double d) {
+    out.append(reinterpret_cast<const char *>(&d), sizeof(d));
+}
+
+inline void put_str(std::string& out, const std::string& s) {
+    put_u64(out, s.size());
+    out += s;
+}
+
+//чтение с проверкой границ: поврежденная запись дает исключение, а не падение
+typedef struct Reader {
+    const char *p;
+    const char *end;
+
+    Reader(const char *data, size_t size) : p(data), end(data + size) {}
+
+    void need(size_t n) const {
+        if (static_cast<size_t>(end - p) < n) throw std::runtime_error("Corrupted cache entry");
+    }
+
+    uint64_t u64() {
+        uint64_t x;
+        need(sizeof(x));
+        std::memcpy(&x, p, sizeof(x));
+        p += sizeof(x);
+        return x;
+    }
+
+    double f64() {
+        double d;
+        need(sizeof(d));
+        std::memcpy(&d, p, sizeof(d));
+        p += sizeof(d);
+        return d;
+    }
+
+    std::string str() {
+        uint64_t n = u64();
+        need(n);
+        std::string s(p, n);
+        p += n;
+        return s;
+    }
+} Reader;
+
+//FNV-1a, 64 бита: значение не зависит от версии стандартной библиотеки
+inline uint64_t fnv1a(const char *data, size_t size, uint64_t h = 14695981039346656037ull) {
+    for (size_t i = 0; i < size; ++i) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+//приемник записей состояния интерпретатора: имя с префиксом таблицы и сериализованное значение
+typedef std::function<void(const std::string& name, const std::string& value)> StateSink;
@@ -0,0 +1,199 @@
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "Value.h"
+#include "Frame.h"
+
+
+//тело \sum и \prod без размерностей, присваиваний и вызовов функций переводится
+//в обратную польскую запись над double: ее можно выполнять без Value, таблиц имен и из любого потока
+typedef struct Op {
+    Tag tag;                            //NUMBER - константа, IDENT - счетчик, KEYWORD - встроенная функция
+    double value = 0;
+    const Builtin *builtin = nullptr;
+} Op;
+
+static const long long chunk = 4096;            //итераций в частичной сумме; порядок сложения от числа потоков не зависит
+static const long long parallel_from = 1 << 16; //меньше - быстрее посчитать в одном потоке
+
+bool Node::compile(std::vector<Op>& code, const std::string& counter, Scope *scope) const {
+    switch (_tag) {
+        case NUMBER:
+            code.push_back({NUMBER, _number});
+            return true;
+        case IDENT: {
+            if (!fields.empty()) {
+                return false;
+            }
+            if (*_label == counter) {
+                code.push_back({IDENT});
+                return true;
+            }
+            //тело переменные не меняет: значение берется один раз до цикла
+            const Value *v = find(_slot, _global, scope);
+            if (!v || v->_type != Value::DOUBLE || !Value::is_dimensionless(*v)) {
+                return false;
+            }
+            code.push_back({NUMBER, v->get_double()});
+            return true;
+        }
+        case UADD:
+        case LPAREN:
+            return right->compile(code, counter, scope);
+        case USUB:
+        case ABS:
+            if (!right->compile(code, counter, scope)) {
+                return false;
+            }
+            code.push_back({_tag});
+            return true;
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case FRAC:
+        case POW:
+            if (!left->compile(code, counter, scope) || !right->compile(code, counter, scope)) {
+                return false;
+            }
+            code.push_back({_tag == FRAC ? DIV : _tag});
+            return true;
+        case KEYWORD:
+            if (!_builtin || fields.size() != static_cast<size_t>(_builtin->argc)) {
+                return false;
+            }
+            if (_builtin->argc == 0) {
+                code.push_back({NUMBER, _builtin->value});
+                return true;
+            }
+            for (auto field : fields) {
+                if (!field->compile(code, counter, scope)) {
+                    return false;
+                }
+            }
+            code.push_back({KEYWORD, 0, _builtin});
+            return true;
+        default:
+            return false;
+    }
+}
+
+//значение тела при счетчике x; деление на ноль - false, ошибку с координатами сообщит обычное исполнение
+static bool run(const std::vector<Op>& code, double x, std::vector<double>& stack, double& res) {
+    size_t top = 0;
+    for (auto& op : code) {
+        switch (op.tag) {
+            case NUMBER: stack[top++] = op.value; break;
+            case IDENT: stack[top++] = x; break;
+            case USUB: stack[top - 1] = -stack[top - 1]; break;
+            case ABS: stack[top - 1] = std::abs(stack[top - 1]); break;
+            case ADD: --top; stack[top - 1] += stack[top]; break;
+            case SUB: --top; stack[top - 1] -= stack[top]; break;
+            case MUL: --top; stack[top - 1] *= stack[top]; break;
+            case DIV:
+                --top;
+                if (stack[top] == 0.0) return false;
+                stack[top - 1] /= stack[top];
+                break;
+            case POW: --top; stack[top - 1] = std::pow(stack[top - 1], stack[top]); break;
+            default:
+                if (op.builtin->argc == 1) {
+                    stack[top - 1] = op.builtin->f1(stack[top - 1]);
+                } else {
+                    --top;
+                    stack[top - 1] = op.builtin->f2(stack[top - 1], stack[top]);
+                }
+        }
+    }
+    res = stack[0];
+    return true;
+}
+
+//частичные суммы (произведения) по кускам из chunk итераций, потом - по порядку кусков
+static bool reduce(const std::vector<Op>& code, double lo, long long n, bool product, double& res) {
+    long long chunks = (n + chunk - 1) / chunk;
+    std::vector<double> part(chunks, product ? 1.0 : 0.0);
+    std::vector<char> ok(chunks, 1);
+
+    auto work = [&](long long first, long long step) {
+        std::vector<double> stack(code.size());
+        for (long long c = first; c < chunks; c += step) {
+            double acc = part[c], term;
+            for (long long k = c * chunk, e = std::min(n, k + chunk); k < e; ++k) {
+                if (!run(code, lo + static_cast<double>(k), stack, term)) {
+                    ok[c] = 0;
+                    break;
+                }
+                acc = product ? acc * term : acc + term;
+            }
+            part[c] = acc;
+        }
+    };
+
+    long long threads = n < parallel_from ? 1 : std::min<long long>(std::thread::hardware_concurrency(), chunks);
+    if (threads > 1) {
+        std::vector<std::thread> pool;
+        for (long long t = 1; t < threads; ++t) {
+            pool.emplace_back(work, t, threads);
+        }
+        work(0, threads);
+        for (auto& t : pool) {
+            t.join();
+        }
+    } else {
+        work(0, 1);
+    }
+
+    res = product ? 1.0 : 0.0;
+    for (long long c = 0; c < chunks; ++c) {
+        if (!ok[c]) return false;
+        res = product ? res * part[c] : res + part[c];
+    }
+    return true;
+}
+
+//\sum_{k=a}^{b} и \prod_{k=a}^{b}: k = a, a + 1, ... пока k <= b, счетчик виден только телу
+Value Node::series(Scope *scope) {
+    Value a = left->exec(scope);
+    Value b = cond->exec(scope);
+    if (a._type != Value::DOUBLE || b._type != Value::DOUBLE ||
+        !Value::is_dimensionless(a) || !Value::is_dimensionless(b)) {
+        throw Error(_offset, "Bounds must be dimensionless numbers");
+    }
+    double lo = a.get_double(), hi = b.get_double();
+    if (hi - lo >= 1e15) {
+        throw Error(_offset, "Too many iterations");
+    }
+    long long n = (hi >= lo) ? static_cast<long long>(std::floor(hi - lo)) + 1 : 0;
+    bool product = _tag == PRODUCT;
+
+    std::vector<Op> code;
+    double res;
+    if (right->compile(code, *_label, scope) && reduce(code, lo, n, product, res)) {
+        return {res, Value::dimensionless};
+    }
+
+    //общий случай: размерности, матрицы, присваивания в теле.
+    //счетчик в теле функции - ячейка кадра, иначе - глобальное имя на время цикла
+    Value *counter = (scope && _slot >= 0) ? &scope->slots[_slot] : &global[_global];
+    Value saved = *counter;     //UNDEFINED - имени до цикла не было
+    Value acc(product ? 1.0 : 0.0);
+    try {
+        for (long long k = 0; k < n; ++k) {
+            *counter = Value(lo + static_cast<double>(k));
+            Value term = right->exec(scope);
+            if (k == 0) {
+                acc = term;     //начинать с терма, а не с 0: сумма размерных величин сохраняет размерность
+            } else {
+                acc = product ? Value::mul(acc, term, _offset) : Value::plus(acc, term, _offset);
+            }
+        }
+    }
+    catch (...) {
+        *counter = saved;
+        throw;
+    }
+    *counter = saved;
+    return acc;
+}
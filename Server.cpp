@@ -0,0 +1,263 @@
+#include <iostream>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Server.h"
+#include "Preprocessor.h"
+#include "Value.h"
+#include "basic_HM.h"
+
+
+//ошибка в самом запросе: неверный JSON, неизвестный метод, нет параметра
+typedef struct RequestError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+} RequestError;
+
+static std::string param(const Json& req, const char *name) {
+    const Json *p = req.get(name);
+    if (!p || p->type != Json::STRING) {
+        throw RequestError(std::string("Missing string parameter '") + name + "'");
+    }
+    return p->string;
+}
+
+//текст запроса как программа блока: координаты ошибок считаются от начала текста,
+//программа кончается после последнего перевода строки, как перед \end{preproc} в файле (он закрывает \sum)
+static ProgramString program_of(std::string text) {
+    ProgramString ps;
+    while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) text.pop_back();
+    ps.assign(text + '\n');
+    ps.last = ps.length;
+    Position::lines.reset(ps.program);
+    return ps;
+}
+
+static bool write_all(int fd, const std::string& s) {
+    size_t done = 0;
+    while (done < s.size()) {
+        ssize_t n = send(fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK) n = write(fd, s.data() + done, s.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+Server::Server(BlockCache *cache) : cache_(cache) {
+    Node::global.clear();
+    Node::reps.clear();
+    reset_analysis();
+}
+
+//файл обрабатывается со своим состоянием, состояние сессии сохраняется и возвращается
+Json Server::process(const Json& req) {
+    std::string in = param(req, "file");
+    std::string out = req.str("output");
+    bool replace = out.empty() || out == in;
+    if (replace) out = temp_name(in);
+
+    GlobalTable global = Node::global;
+    AnalysisState analysis = analysis_state();
+    Failure failure;
+    bool ok = process_file(in.c_str(), out.c_str(), replace, cache_, &failure);
+    Node::global = std::move(global);
+    restore_analysis(analysis);
+    Node::reps.clear();
+    if (!ok) {
+        throw failure;
+    }
+
+    Json res = Json::make_object();
+    res["output"] = replace ? in : out;
+    return res;
+}
+
+Json Server::eval_block(const Json& req) {
+    Position::ps = program_of(param(req, "text"));
+    Node::reps.clear();
+    Arena arena;
+    std::string replacement = ::eval_block(parse_block(Position::ps, arena), Position::ps);
+
+    Json res = Json::make_object();
+    res["replacement"] = replacement;
+    return res;
+}
+
+//выражение исполняется как блок, результат - значение последнего выражения
+Json Server::eval(const Json& req) {
+    Position::ps = program_of(param(req, "expr"));
+    Node::reps.clear();
+    Arena arena;
+    Node *root = parse_block(Position::ps, arena);
+    Json res = Json::make_object();
+    root->semantic_analysis();
+    Value v = root->exec({});
+    res["type"] = Value::type_string(v._type);
+    res["value"] = v._type == Value::FUNCTION ? std::string() : to_string(v);
+    Node::reps.clear();
+    return res;
+}
+
+std::string Server::handle(const std::string& line) {
+    auto start = std::chrono::steady_clock::now();
+
+    Json id;
+    Json result = Json::make_object();
+    Failure failure;
+    bool ok = false;
+    try {
+        Json req = Json::parse(line);
+        if (req.type != Json::OBJECT) {
+            throw RequestError("Request must be an object");
+        }
+        if (const Json *p = req.get("id")) id = *p;
+        std::string method = req.str("method");
+
+        if (method == "reset") {
+            Node::global.clear();
+            reset_analysis();
+            ok = true;
+        } else if (method == "shutdown") {
+            stop_ = true;
+            ok = true;
+        } else {
+            Json (Server::*f)(const Json&);
+            if (method == "process") f = &Server::process;
+            else if (method == "eval_block") f = &Server::eval_block;
+            else if (method == "eval") f = &Server::eval;
+            else throw RequestError("Unknown method '" + method + "'");
+
+            GlobalTable global = Node::global;
+            AnalysisState analysis = analysis_state();
+            try {
+                ok = run_reported("", [&]() { result = (this->*f)(req); }, &failure);
+            }
+            catch (Failure& err) {
+                failure = err;
+            }
+            if (!ok) {      //после ошибки блок мог оставить состояние наполовину измененным
+                Node::global = std::move(global);
+                restore_analysis(analysis);
+                Node::reps.clear();
+            }
+        }
+    }
+    catch (std::exception& err) {
+        failure = Failure{"request", err.what()};
+    }
+
+    Json resp = Json::make_object();
+    resp["id"] = id;
+    resp["ok"] = ok;
+    if (ok) {
+        resp["result"] = std::move(result);
+    } else {
+        Json& e = resp["error"];
+        e["kind"] = failure.kind;
+        e["message"] = failure.message;
+        if (failure.line) {
+            e["line"] = static_cast<double>(failure.line);
+            e["column"] = static_cast<double>(failure.column);
+        }
+    }
+    auto diff = std::chrono::steady_clock::now() - start;
+    resp["ms"] = std::chrono::duration<double, std::milli>(diff).count();
+    return resp.dump() + "\n";
+}
+
+int Server::serve_stdio() {
+    //ответы идут в исходный stdout, отладочный вывод интерпретатора - в stderr
+    std::cout.flush();
+    int out = dup(STDOUT_FILENO);
+    if (out == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+        std::cerr << "Couldn't redirect stdout" << std::endl;
+        return 1;
+    }
+    std::string line;
+    while (!stop_ && std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        std::string resp = handle(line);
+        std::cout.flush();
+        if (!write_all(out, resp)) break;
+    }
+    close(out);
+    return 0;
+}
+
+int Server::serve_socket(const char *path) {
+    sockaddr_un addr{};
+    if (std::strlen(path) >= sizeof(addr.sun_path)) {
+        std::cerr << path << ":" << "Socket path is too long" << std::endl;
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (listener == -1 || bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1
+        || listen(listener, 16) == -1) {
+        std::cerr << path << ":" << "Couldn't listen on socket: " << std::strerror(errno) << std::endl;
+        if (listener != -1) close(listener);
+        return 1;
+    }
+    std::cerr << path << ": listening" << std::endl;
+
+    typedef struct Client {
+        int fd;
+        std::string buffer;     //начало неполной строки запроса
+    } Client;
+    std::vector<Client> clients;
+    std::vector<pollfd> fds;
+
+    while (!stop_) {
+        fds.assign(1, pollfd{listener, POLLIN, 0});
+        for (auto& c : clients) fds.push_back(pollfd{c.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) continue;
+            std::cerr << path << ":" << "poll failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd != -1) clients.push_back(Client{fd, {}});
+        }
+        //fds[i + 1] соответствует clients[i], новые клиенты в конце
+        for (size_t i = fds.size() - 1; i-- > 0 && !stop_;) {
+            if (!fds[i + 1].revents) continue;
+            Client& c = clients[i];
+            char buf[65536];
+            ssize_t n = read(c.fd, buf, sizeof(buf));
+            bool alive = n > 0;
+            if (alive) c.buffer.append(buf, n);
+            size_t pos;
+            while (alive && !stop_ && (pos = c.buffer.find('\n')) != std::string::npos) {
+                std::string line = c.buffer.substr(0, pos);
+                c.buffer.erase(0, pos + 1);
+                if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+                std::string resp = handle(line);
+                std::cout.flush();
+                alive = write_all(c.fd, resp);
+            }
+            if (!alive) {
+                close(c.fd);
+                clients.erase(clients.begin() + i);
+            }
+        }
+    }
+
+    for (auto& c : clients) close(c.fd);
+    close(listener);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+
+#include "Cache.h"
+#include "Json.h"
+
+
+//режим сервера: запросы - строки JSON, на каждый запрос одна строка ответа.
+//  {"id": 1, "method": "process", "file": "a.tex", "output": "b.tex"}  - как запуск с аргументами,
+//      без output файл перезаписывается; у файла свое состояние, состояние сессии не меняется
+//  {"id": 2, "method": "eval_block", "text": "x := 2 \\ x = \placeholder{}"} - блок в состоянии сессии
+//  {"id": 3, "method": "eval", "expr": "x * 3"}   - значение выражения в состоянии сессии
+//  {"id": 4, "method": "reset"}                   - очистить состояние сессии
+//  {"id": 5, "method": "shutdown"}
+//ответ: {"id":..,"ok":true,"result":{..},"ms":..} или {"id":..,"ok":false,"error":{..},"ms":..}.
+//запросы исполняются по одному в главном потоке, таблицы лексера и состояние сессии
+//(Node::global и таблицы анализатора) живут между запросами; при ошибке состояние откатывается
+class Server {
+public:
+    explicit Server(BlockCache *cache = nullptr);
+
+    int serve_stdio();                  //stdout интерпретатора перенаправляется в stderr
+
+    int serve_socket(const char *path); //сокет домена Unix, клиентов может быть несколько
+
+    Server(Server const&) = delete;
+    Server& operator=(Server const&) = delete;
+
+private:
+    BlockCache *cache_;
+    bool stop_ = false;
+
+    std::string handle(const std::string& line);
+
+    Json process(const Json& req);
+
+    Json eval_block(const Json& req);
+
+    Json eval(const Json& req);
+};
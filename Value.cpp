@@ -4,16 +4,33 @@
 #include <utility>
 
 #include "Value.h"
+#include "Flat.h"
+#include "Frame.h"
 #include "basic_HM.h"
 
 
-Func::Func(const Func &f) : argv(f.argv) {
-    local = f.local;
-    body = new Node(*f.body);
+Func::Func(std::vector<std::string> as, const Node *b) :
+argv(std::move(as)), body(b ? b->copy(arena) : nullptr) {
+    if (body) bind();
 }
 
-Func::Func(std::vector<std::string> as, name_table nt, Node *b) :
-argv(std::move(as)), local(std::move(nt)), body(b) {}
+void Func::bind() {
+    slots = argv;
+    body->bind_slots(slots);
+    names.clear();
+    for (auto& name : slots) {
+        names.push_back(GlobalTable::slot(name));
+    }
+    //аргументы всегда в кадре, остальное может прийти из места объявления
+    free.clear();
+    body->referenced(free);
+    std::sort(free.begin(), free.end());
+    free.erase(std::unique(free.begin(), free.end()), free.end());
+    for (size_t i = 0; i < argv.size(); ++i) {
+        auto it = std::lower_bound(free.begin(), free.end(), names[i]);
+        if (it != free.end() && *it == names[i]) free.erase(it);
+    }
+}
 
 
 Value::BadType::BadType(Type actual, Type expected) {
@@ -25,7 +42,9 @@ const char* Value::BadType::what() {
     return msg.c_str();
 }
 
-Value::Value() : _type(UNDEFINED) {}
+Value::Value() : _type(UNDEFINED) {
+    _double_data = 0.0;     //INFERRED_* значения создаются из пустого, данные должны быть определены
+}
 
 Value::Value(std::array<int, 7> dim) : _type(DOUBLE) {
     _double_data = 1.0;
@@ -60,8 +79,19 @@ Value::Value(Matrix m, std::array<int, 7> dim) : _type(MATRIX) {
     }
 }
 
-Value::Value(Func *f) : _type(FUNCTION) {
-    _function_data = new Func(*f);
+Value::Value(const Func *f) : _type(FUNCTION) {
+    _function_data = f;
+}
+
+static void release(const Func *f) {
+    if (f->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete f;
+    }
+}
+
+static const Func *retain(const Func *f) {
+    f->refs.fetch_add(1, std::memory_order_relaxed);
+    return f;
 }
 
 Value::Value(const Value &other) : _type(other._type) {
@@ -77,7 +107,7 @@ Value::Value(const Value &other) : _type(other._type) {
             }
         }
     } else if (_type == FUNCTION) {
-        _function_data = new Func(*other._function_data);
+        _function_data = retain(other._function_data);
     }
 }
 
@@ -91,7 +121,7 @@ Value& Value::operator=(const Value &other) {
             delete _matrix_data;
             _dimension.fill(0);
         } else if (_type == FUNCTION) {
-            delete _function_data;
+            release(_function_data);
         }
         _type = other._type;
         if (_type == DOUBLE || _type == INFERRED_DOUBLE) {
@@ -106,7 +136,7 @@ Value& Value::operator=(const Value &other) {
                 }
             }
         } else if (_type == FUNCTION) {
-            _function_data = new Func(*other._function_data);
+            _function_data = retain(other._function_data);
         }
     }
 
@@ -115,7 +145,99 @@ Value& Value::operator=(const Value &other) {
 
 Value::~Value() {
     if (_type == MATRIX || _type == INFERRED_MATRIX) delete _matrix_data;
-    if (_type == FUNCTION) delete _function_data;
+    if (_type == FUNCTION) release(_function_data);
+}
+
+void Value::save(std::string& out) const {
+    out += static_cast<char>(_type);
+    for (int d : _dimension) {
+        put_u64(out, static_cast<uint64_t>(d));
+    }
+    if (_type == DOUBLE || _type == INFERRED_DOUBLE) {
+        put_f64(out, _double_data);
+    } else if (_type == MATRIX || _type == INFERRED_MATRIX) {
+        if (!_matrix_data) {
+            put_u64(out, 0);
+            return;
+        }
+        put_u64(out, _matrix_data->size());
+        for (auto& row : *_matrix_data) {
+            put_u64(out, row.size());
+            for (auto& v : row) {
+                v.save(out);
+            }
+        }
+    } else if (_type == FUNCTION) {
+        put_u64(out, _function_data->argv.size());
+        for (auto& a : _function_data->argv) {
+            put_str(out, a);
+        }
+        save_table(_function_data->local, out);
+        _function_data->body->save(out);
+    }
+}
+
+Value Value::load(Reader& in) {
+    Value res;
+    in.need(1);
+    auto t = static_cast<Type>(*in.p++);
+    std::array<int, 7> dim{};
+    for (int& d : dim) {
+        d = static_cast<int>(in.u64());
+    }
+    if (t == DOUBLE || t == INFERRED_DOUBLE) {
+        res = Value(in.f64(), dim);
+    } else if (t == MATRIX || t == INFERRED_MATRIX) {
+        uint64_t rows = in.u64();
+        Matrix m;
+        for (uint64_t i = 0; i < rows; ++i) {
+            uint64_t cols = in.u64();
+            m.emplace_back();
+            for (uint64_t j = 0; j < cols; ++j) {
+                m.back().push_back(load(in));
+            }
+        }
+        res = Value(m, dim);
+    } else if (t == FUNCTION) {
+        uint64_t n = in.u64();
+        std::vector<std::string> argv;
+        for (uint64_t i = 0; i < n; ++i) {
+            argv.push_back(in.str());
+        }
+        auto f = std::make_unique<Func>(std::move(argv));
+        f->local = load_table(in);
+        f->body = Node::load(in, f->arena);
+        f->body->resolve_names();
+        f->bind();
+        res._type = FUNCTION;
+        res._function_data = f.release();
+        res._dimension = dim;
+        return res;
+    } else if (t != UNDEFINED) {
+        throw std::runtime_error("Corrupted cache entry");
+    }
+    res._type = t;
+    res._dimension = dim;
+    return res;
+}
+
+//в кэше - имена: номера в другом процессе другие
+void save_table(const Captures& nt, std::string& out) {
+    put_u64(out, nt.size());
+    nt.each([&out](const std::string& name, const Value& v) {
+        put_str(out, name);
+        v.save(out);
+    });
+}
+
+Captures load_table(Reader& in) {
+    Captures nt;
+    uint64_t n = in.u64();
+    for (uint64_t i = 0; i < n; ++i) {
+        int slot = GlobalTable::slot(in.str());
+        nt.set(slot, Value::load(in));
+    }
+    return nt;
 }
 
 // Функции ниже в зависимости от типа возвращают значение или бросают исключение
@@ -144,7 +266,7 @@ Matrix& Value::get_matrix() const {
     return *_matrix_data;
 }
 
-Func* Value::get_function() const {
+const Func* Value::get_function() const {
     if (_type != FUNCTION) {
         std::cout << "error in get_function()\n";
         throw BadType(_type, FUNCTION);
@@ -160,53 +282,87 @@ Replacement::Replacement(Tag t, size_t b, size_t e, const Value& v) :
 tag(t), begin(b), end(e), replacement(v) {}
 
 
-Node::Node(Token *t) {
-    _coord = t->start.start;
+Node::Node(Arena &a, Token *t) : fields(a.resource()) {
+    _offset = t->at();
     _tag = t->_tag;
     if (_tag == NUMBER || _tag == IDENT || _tag == KEYWORD || _tag == DIMENSION) {
-        _label = t->raw;
+        _label = a.intern(t->raw());
     } else
-        _label = t->_ident;
+        _label = tag_label(_tag);
     _priority = t_info[_tag].priority;
+    resolve();
 
     if (_tag == PLACEHOLDER) {
-        Node::save_rep(_coord, PLACEHOLDER, t->end.index - 2, t->end.index);
+        Node::save_rep(_offset, PLACEHOLDER, t->end() - 2, t->end());
     }
 }
 
-void Node::save_rep(const Coordinate& c, Tag t, size_t a, size_t b) {
+void Node::save_rep(size_t c, Tag t, size_t a, size_t b) {
     Node::reps[c] = Replacement(t, a, b);
 }
 
-void Node::copy_defs(name_table &local, name_table *ptr) {
-    if (ptr) local.insert(ptr->begin(), ptr->end());
-    else local.insert(global.begin(), global.end());
+//копируются только имена, которые упоминает тело. в функции видны заполненные ячейки кадра,
+//под ними - захваченное ею; глобальные имена тело и так найдет при вызове
+void Node::capture(Func &f, Scope *ptr) {
+    for (int name : f.free) {
+        const Value *v;
+        if (ptr) {
+            auto& names = ptr->func->names;
+            auto it = std::find(names.begin(), names.end(), name);
+            v = (it != names.end()) ? &ptr->slots[it - names.begin()] : nullptr;
+            if (!v || v->_type == Value::UNDEFINED) v = ptr->func->local.find(name);
+        } else {
+            v = global.find(name);
+        }
+        if (v) f.local.set(name, *v);
+    }
 }
 
-Value &Node::lookup(const std::string& name, name_table *ptr, const Coordinate& pos) {
+//порядок поиска: ячейка кадра (пустая - UNDEFINED), захваченные функцией, глобальные
+const Value *Node::find(int slot, int gslot, Scope *ptr) {
     if (ptr) {
-        auto res = ptr->find(name);
-        if (res != ptr->end()) {
-            return res->second;
+        if (slot >= 0 && ptr->slots[slot]._type != Value::UNDEFINED) {
+            return &ptr->slots[slot];
+        }
+        if (const Value *cap = ptr->func->local.find(gslot)) {
+            return cap;
         }
     }
-    auto res = global.find(name);
-    if (res != global.end()) {
-        return res->second;
+    return global.find(gslot);
+}
+
+const Value &Node::lookup(int slot, int gslot, Scope *ptr, size_t pos) {
+    const Value *res = find(slot, gslot, ptr);
+    if (!res) {
+        throw Error(pos, "Undefined variable reference");
     }
-    throw Error(pos, "Undefined variable reference");
+    return *res;
 }
 
-void Node::def(const std::string& name, const Value& val, name_table *ptr) {
-//    std::cout << "def is invoked for name = " << name << "\n";
-    if (ptr) {
-        auto res = global.find(name);
-        if (res == global.end()) {
-            (*ptr)[name] = val;
-            return;
+//захваченные имена общие для всех копий функции: изменяемая копия заводится в ячейке кадра
+Value &Node::writable(int slot, int gslot, Scope *ptr, size_t pos) {
+    if (ptr && slot >= 0) {
+        Value &cell = ptr->slots[slot];
+        if (cell._type != Value::UNDEFINED) {
+            return cell;
         }
+        if (const Value *cap = ptr->func->local.find(gslot)) {
+            cell = *cap;
+            return cell;
+        }
+    }
+    if (global.find(gslot)) {
+        return global[gslot];
     }
-    global[name] = val;
+    throw Error(pos, "Undefined variable reference");
+}
+
+void Node::def(int slot, int gslot, const Value& val, Scope *ptr) {
+    if (ptr && slot >= 0 && !global.find(gslot)) {
+        ptr->slots[slot] = val;
+        return;
+    }
+    global[gslot] = val;
 }
 
 // Семантический анализ (проверка размерностей)
@@ -216,39 +372,54 @@ void Node::semantic_analysis() {
             field->semantic_analysis();
         }
     } else {
-        analyse(this, false, {}, false);
+        analyse(NodeRef{this}, false, {}, false);
     }
 }
 
-Value Node::exec(name_table *scope = nullptr) {
-    if (_tag == NUMBER) {   //если это NUMBER, то в _label записана строка с числом
-        double val = std::stod(this->_label);
-        return {val, Value::dimensionless};
+//исполнение узла в любой раскладке дерева (Ref - NodeRef или FlatTree::Ref)
+template <class Ref>
+Value evaluate(Ref n, Scope *scope) {
+    Tag tag = n.tag();
+    if (tag == NUMBER) {   //число разобрано при построении узла
+        return {n.number(), Value::dimensionless};
     }
-    else if (_tag == BEGINM) {  //это матрица, нужно собрать из полей Matrix
+    else if (tag == BEGINM) {  //это матрица, нужно собрать из полей Matrix
         Matrix m;   //при построении проверяется, что матрица прямоугольная и как минимум 1 х 1, поэтому здесь проверки не нужны
-        for (auto & field : fields) {   //цикл по строкам
+        for (size_t i = 0; i < n.size(); ++i) {   //цикл по строкам
+            Ref row = n.field(i);
             std::vector<Value> v;
-            for (auto & jt : field->fields) { //цикл по элементам строк
-                v.push_back(jt->exec(scope));
+            for (size_t j = 0; j < row.size(); ++j) { //цикл по элементам строк
+                v.push_back(evaluate(row.field(j), scope));
             }
             m.push_back(v);
         }
         return {m};
     }
-    else if (_tag == IDENT) {   //переменная
-        Value x_val = Node::lookup(_label, scope, _coord);
-        size_t sz = fields.size();
+    else if (tag == PMATRIX) {     //числовая матрица: значения уже разобраны, узлов на элементы нет
+        const NumericMatrix &nm = n.numbers();
+        Matrix m(nm.rows);
+        const double *p = nm.data.data();
+        for (auto & row : m) {
+            row.reserve(nm.cols);
+            for (size_t j = 0; j < nm.cols; ++j) {
+                row.emplace_back(*p++, Value::dimensionless);
+            }
+        }
+        return {std::move(m)};
+    }
+    else if (tag == IDENT) {   //переменная
+        size_t sz = n.size();
         if (sz == 0) {  //обычная переменная
-            return x_val;
+            return Node::lookup(n.slot(), n.global(), scope, n.offset());
         } else {
-            Matrix *m = &x_val.get_matrix();
+            //элемент читается из хранимой матрицы, без копии
+            const Matrix *m = &Node::lookup(n.slot(), n.global(), scope, n.offset()).get_matrix();
             size_t ver = (*m).size();
             size_t hor = (*m)[0].size();
 
-            int int_i = (int) fields[0]->exec(scope).get_double();
+            int int_i = (int) evaluate(n.field(0), scope).get_double();
             if (int_i < 0) {
-                throw Error(left->_coord, "Negative index");
+                throw Error(n.field(0).offset(), "Negative index");
             }
             size_t i = int_i;
             size_t j = 0;
@@ -259,56 +430,62 @@ Value Node::exec(name_table *scope = nullptr) {
                     j = i;
                     i = 0;
                 } else if (hor != 1) {
-                    throw Error(_coord, "Can't use vector index for matrix");
+                    throw Error(n.offset(), "Can't use vector index for matrix");
                 }
             } else if (sz == 2) { //элемент матрицы
-                int int_j = (int) fields[1]->exec(scope).get_double();
+                int int_j = (int) evaluate(n.field(1), scope).get_double();
                 if (int_j < 0) {
-                    throw Error(left->_coord, "Negative index");
+                    throw Error(n.field(1).offset(), "Negative index");
                 }
                 j = int_j;
             }
             if (i >= ver || j >= hor) {
-                throw Error(_coord, "Index is out of range");
+                throw Error(n.offset(), "Index is out of range");
+            }
+            //вызов функции в индексе мог переприсвоить глобальное имя: матрица берется заново
+            m = &Node::lookup(n.slot(), n.global(), scope, n.offset()).get_matrix();
+            if (i >= (*m).size() || j >= (*m)[0].size()) {
+                throw Error(n.offset(), "Index is out of range");
             }
             return (*m)[i][j];
         }
 
     }
-    else if (_tag == FUNC) {  //вызов функции
+    else if (tag == FUNC) {  //вызов функции
         //область видимости переменных -- функция
-        Value f_val = Node::lookup(_label, scope, _coord);
-        Func *f = f_val.get_function();
-        //загрузка значений имен переменных
-        size_t f_s = fields.size();
-        std::vector<Value> args;
+        Value f_val = Node::lookup(n.slot(), n.global(), scope, n.offset());  //копия - ссылка на Func: тело может переопределить имя
+        const Func *f = f_val.get_function();
+        //аргументы вычисляются в области вызывающего сразу в ячейки нового кадра
+        Frame frame(f, n.offset());
+        size_t f_s = n.size();
         for (size_t i = 0; i < f_s; ++i) {
-            args.push_back(fields[i]->exec(scope));
+            Value arg = evaluate(n.field(i), scope);
+            if (i < f->argv.size()) frame[i] = arg;
         }
-        return Value::call(f_val, args, _coord);
+        return frame.run();
     }
-    else if (_tag == UADD || _tag == LPAREN) {
-        return right->exec(scope);
+    else if (tag == UADD || tag == LPAREN) {
+        return evaluate(n.right(), scope);
     }
-    else if (_tag == USUB) {
-        return Value::usub(right->exec(scope), _coord);
+    else if (tag == USUB) {
+        return Value::usub(evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == NOT) {
-        return Value::eq(right->exec(scope), Value(0.0, Value::dimensionless), _coord);
+    else if (tag == NOT) {
+        return Value::eq(evaluate(n.right(), scope), Value(0.0, Value::dimensionless), n.offset());
     }
-    else if (_tag == SET) {
-        if (left->_tag == IDENT) {
-            size_t sz = left->fields.size();
+    else if (tag == SET) {
+        Ref left = n.left();
+        if (left.tag() == IDENT) {
+            size_t sz = left.size();
             if (sz == 0) {    //переменная
-                Node::def(left->_label, right->exec(scope), scope);
+                Node::def(left.slot(), left.global(), evaluate(n.right(), scope), scope);
             } else {    //матрица
-                Value *m_val = &Node::lookup(left->_label, scope, left->_coord);
-                Matrix *m = &m_val->get_matrix();
+                Matrix *m = &Node::writable(left.slot(), left.global(), scope, left.offset()).get_matrix();
                 size_t ver = (*m).size();
                 size_t hor = (*m)[0].size();
-                int int_i = (int) left->fields[0]->exec(scope).get_double();
+                int int_i = (int) evaluate(left.field(0), scope).get_double();
                 if (int_i < 0) {
-                    throw Error(left->_coord, "Negative index");
+                    throw Error(left.offset(), "Negative index");
                 }
                 size_t i = int_i;
                 size_t j = 0;
@@ -317,227 +494,233 @@ Value Node::exec(name_table *scope = nullptr) {
                         j = i;
                         i = 0;
                     } else if (hor != 1) {
-                        throw Error(_coord, "Bad index");
+                        throw Error(n.offset(), "Bad index");
                     }
                 } else if (sz == 2) { //элемент матрицы
-                    int int_j = (int) left->fields[1]->exec(scope).get_double();
+                    int int_j = (int) evaluate(left.field(1), scope).get_double();
                     if (int_j < 0) {
-                        throw Error(left->_coord, "Negative index");
+                        throw Error(left.offset(), "Negative index");
                     }
                     j = int_j;
                 } else {
-                    throw Error(_coord, "Bad index");
+                    throw Error(n.offset(), "Bad index");
                 }
                 if (i >= ver || j >= hor) {
-                    throw Error(_coord, "Index is out of range");
+                    throw Error(n.offset(), "Index is out of range");
                 }
-                (*m)[i][j] = right->exec(scope);
+                Value elem = evaluate(n.right(), scope);
+                //индексы и правая часть могли переприсвоить имя: ячейка и матрица берутся заново
+                m = &Node::writable(left.slot(), left.global(), scope, left.offset()).get_matrix();
+                if (i >= (*m).size() || j >= (*m)[0].size()) {
+                    throw Error(n.offset(), "Index is out of range");
+                }
+                (*m)[i][j] = elem;
                 return {0.0, Value::dimensionless};
             }
         }
-        else if (left->_tag == FUNC) { //функция
+        else if (left.tag() == FUNC) { //функция
             std::vector<std::string> ns;
             //список аргументов функции
             //при объявлении функции допустимы только IDENT в списке аргументов
-            for (auto it = left->fields.begin(); it < left->fields.end(); ++it) {
-                ns.push_back((*it)->_label);
+            for (size_t i = 0; i < left.size(); ++i) {
+                ns.push_back(left.field(i).label());
             }
             //если функция объявляется глобально, ссылаться на Node из дерева нельзя
-            //т.к. для каждого блока preproc строится новое, а старое удаляется
-            Node *copy_of_right = new Node(*right);
-            Func *f = (scope) ? new Func(ns, *scope, copy_of_right) : new Func(ns, global, copy_of_right);
-            Value func_v = Value(f);
-            Node::def(left->_label, func_v, scope);
+            //т.к. арена блока освобождается после него: тело копируется в арену функции
+            auto f = std::make_unique<Func>(ns, n.right().node());
+            Node::capture(*f, scope);
+            Value func_v(f.release());
+            Node::def(left.slot(), left.global(), func_v, scope);
         } else {
-            throw Error(_coord, "Can't define this");
+            throw Error(n.offset(), "Can't define this");
         }
     }
-    else if (_tag == ADD) {
-        return Value::plus(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == ADD) {
+        return Value::plus(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == SUB) {
-        return Value::sub(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == SUB) {
+        return Value::sub(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == MUL) {
-        return Value::mul(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == MUL) {
+        return Value::mul(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == DIV || _tag == FRAC) {
-        return Value::div(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == DIV || tag == FRAC) {
+        return Value::div(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == POW) {
-        return Value::pow(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == POW) {
+        return Value::pow(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == ABS) {
-        return Value::abs(right->exec(scope), _coord);
+    else if (tag == ABS) {
+        return Value::abs(evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == EQ) {
-        Value res = left->exec(scope);
-        if (right->_tag == PLACEHOLDER) {
-            reps[right->_coord].replacement = res;
+    else if (tag == EQ) {
+        Value res = evaluate(n.left(), scope);
+        Ref right = n.right();
+        if (right.tag() == PLACEHOLDER) {
+            Node::reps[right.offset()].replacement = res;
             return {1.0, Value::dimensionless}; //равенство выполняется, вернуть 1 - нормально
-        } else if (right->left != nullptr && right->left->_tag == PLACEHOLDER) {
-            Value r = Value::div(res, right->right->exec(scope), _coord);
-            reps[right->_coord].replacement = r;
+        } else if (right.left() && right.left().tag() == PLACEHOLDER) {
+            Value r = Value::div(res, evaluate(right.right(), scope), n.offset());
+            Node::reps[right.offset()].replacement = r;
             return {1.0, Value::dimensionless}; //равенство выполняется, вернуть 1 - нормально
         }
-        return Value::eq(res, right->exec(scope), _coord);
+        return Value::eq(res, evaluate(right, scope), n.offset());
     }
-    else if (_tag == NEQ) {
+    else if (tag == NEQ) {
         return {
             static_cast<double>(
-                !Value::eq(left->exec(scope), right->exec(scope), _coord).get_double()
+                !Value::eq(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset()).get_double()
             )
         };
     }
-    else if (_tag == LEQ) {
-        return Value::le(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == LEQ) {
+        return Value::le(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == GEQ) {
-        return Value::ge(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == GEQ) {
+        return Value::ge(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == LT) {
-        return Value::lt(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == LT) {
+        return Value::lt(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == GT) {
-        return Value::gt(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == GT) {
+        return Value::gt(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == AND) {
-        return Value::andd(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == AND) {
+        return Value::andd(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == OR) {
-        return Value::orr(left->exec(scope), right->exec(scope), _coord);
+    else if (tag == OR) {
+        return Value::orr(evaluate(n.left(), scope), evaluate(n.right(), scope), n.offset());
     }
-    else if (_tag == ROOT) {
+    else if (tag == ROOT || tag == BEGINB) {
         Value res(0.0);
-        for (auto & field : fields) {
-            res = field->exec(scope);
+        for (size_t i = 0; i < n.size(); ++i) {
+            res = evaluate(n.field(i), scope);
         }
         return res;
     }
-    else if (_tag == BEGINB) {
-        Value res(0.0);
-        for (auto & field : fields) {
-            res = field->exec(scope);
-        }
-        return res;
-    }
-    else if (_tag == BEGINC) {
-        for (auto & field : fields) {
-            if (!field->cond || field->cond->exec(scope).get_double() == 1.0) {
-                return field->right->exec(scope);
+    else if (tag == BEGINC) {
+        for (size_t i = 0; i < n.size(); ++i) {
+            Ref alt = n.field(i);
+            if (!alt.cond() || evaluate(alt.cond(), scope).get_double() == 1.0) {
+                return evaluate(alt.right(), scope);
             }
         }
     }
-    else if (_tag == IF) {
-        Value c_val = cond->exec(scope);
+    else if (tag == IF) {
+        Value c_val = evaluate(n.cond(), scope);
         if (c_val.get_double()) {
-            return right->exec(scope);
+            return evaluate(n.right(), scope);
         }
-        else if (left) {
-            return left->exec(scope);
+        else if (n.left()) {
+            return evaluate(n.left(), scope);
         }
     }
-    else if (_tag == WHILE) {
+    else if (tag == WHILE) {
         Value res(0.0);
-        while (cond->exec(scope).get_double() == 1.0) {
-            res = right->exec(scope);
+        while (evaluate(n.cond(), scope).get_double() == 1.0) {
+            res = evaluate(n.right(), scope);
         }
         return res;
     }
-    else if (_tag == PRODUCT) {
-        Value res(0.0);
-        while (cond->exec(scope).get_double() == 1.0) {
-            res = right->exec(scope);
-        }
-        return res;
+    else if (tag == SUM || tag == PRODUCT) {
+        return n.node()->series(scope);
     }
-    else if (_tag == TRANSP) {
-        return Value::transpose(left->exec(scope));
+    else if (tag == TRANSP) {
+        return Value::transpose(evaluate(n.left(), scope));
     }
-    else if (_tag == RANGE) {
+    else if (tag == RANGE) {
         std::vector<Value> row;
-        double a = left->exec(scope).get_double();
-        double b = right->exec(scope).get_double();
-        double d = (cond) ? Value(cond->exec(scope)).get_double() : 0.1;
+        double a = evaluate(n.left(), scope).get_double();
+        double b = evaluate(n.right(), scope).get_double();
+        double d = (n.cond()) ? Value(evaluate(n.cond(), scope)).get_double() : 0.1;
         for (double x = a; x <= b; x += d) {
             row.emplace_back(x);
         }
         if (row.empty()) {
-            throw Error(_coord, "Empty range");
+            throw Error(n.offset(), "Empty range");
         }
         Matrix m;
         m.push_back(row);
         return {m};
     }
-    else if (_tag == GRAPHIC) {
-        Value func_v = Node::lookup(_label, scope, _coord);
-        Func *func = func_v.get_function();
+    else if (tag == GRAPHIC) {
+        Value func_v = Node::lookup(n.slot(), n.global(), scope, n.offset());
+        const Func *func = func_v.get_function();
         size_t sz = func->argv.size();
         std::vector<Value> args(sz);
         size_t ivar = 0;    //номер переменного аргумента
         bool found = false;
         for (size_t i = 0; i < sz; ++i) {
-            if (fields[i]->_tag == RANGE) {
+            if (n.field(i).tag() == RANGE) {
                 if (!found) {
                     ivar = i;
                     found = true;
                 } else {
-                    throw Error(fields[i]->_coord, "More than one parameter range");
+                    throw Error(n.field(i).offset(), "More than one parameter range");
                 }
             } else {
-                args[i] = fields[i]->exec(scope);
+                args[i] = evaluate(n.field(i), scope);
             }
         }
         if (!found) {
-            throw Error(_coord, "No range parameter");
+            throw Error(n.offset(), "No range parameter");
         }
-        Value range_v = fields[ivar]->exec(scope);
+        Value range_v = evaluate(n.field(ivar), scope);
         Matrix *range = &range_v.get_matrix();
 
         Matrix plot;
         for (auto & it : (*range)[0]) {
             args[ivar] = it;
-            double fx = Value::call(func, args, _coord).get_double();
+            Frame frame(func, n.offset());
+            for (size_t i = 0; i < sz; ++i) {
+                frame[i] = args[i];
+            }
+            double fx = frame.run().get_double();
             std::vector<Value> point = {it, Value(fx)};
             plot.push_back(point);
         }
         Value graphic(plot);
-        Node::reps[_coord].replacement = graphic;
+        Node::reps[n.offset()].replacement = graphic;
     }
-    else if (_tag == KEYWORD) {
-        auto res = constants.find(_label);
-        if (res != constants.end()) {
-            return {res->second};
+    else if (tag == KEYWORD) {
+        const Builtin *builtin = n.builtin();
+        if (!builtin) {
+            throw Error(n.offset(), "Keyword is not defined");
+        }
+        if (builtin->argc == 0) {
+            return {builtin->value};
         } else {
-            auto result = arg_count.find(_label);
-            if (result == arg_count.end()) {
-                throw Error(_coord, "Keyword is not defined");
-            }
-            int argc = result->second;
-            if (fields.size() != argc) {
-                throw Error(_coord, "Wrong argument number");
+            int argc = builtin->argc;
+            if (n.size() != argc) {
+                throw Error(n.offset(), "Wrong argument number");
             }
             std::vector<Value> args;
-            for (auto & field : fields) {
-                Value val = field->exec(scope);    //эти функции не принимают только double-ы
+            for (size_t i = 0; i < n.size(); ++i) {
+                Value val = evaluate(n.field(i), scope);    //эти функции не принимают только double-ы
                 args.push_back(val);
             }
             if (argc == 1) {
-                if (_label == "\\floor" || Value::is_dimensionless(args[0])) {
-                    return {funcs1[_label](args[0].get_double()), args[0].get_dimension()};
+                if (builtin->any_dimension || Value::is_dimensionless(args[0])) {
+                    return {builtin->f1(args[0].get_double()), args[0].get_dimension()};
                 } else {
-                    std::string error = _label + " gets only dimensionless argument";
-                    throw Error(_coord, error);
+                    std::string error = n.label() + " gets only dimensionless argument";
+                    throw Error(n.offset(), error);
                 }
             } else if (argc == 2) {
-                return {funcs2[_label](args[0].get_double(), args[1].get_double())};
+                return {builtin->f2(args[0].get_double(), args[1].get_double())};
             }
         }
     }
-    else if (_tag == DIMENSION) {
-        auto res = dimensions.find(_label);
-        return {res->second};
+    else if (tag == DIMENSION) {
+        return {n.dimension()};
     }
 
     return {0.0, Value::dimensionless};
 }
+
+template Value evaluate(NodeRef, Scope *);
+template Value evaluate(FlatTree::Ref, Scope *);
+
+Value Node::exec(Scope *scope = nullptr) {
+    return evaluate(NodeRef{this}, scope);
+}
@@ -6,19 +6,14 @@
 #include <iomanip>
 #include <algorithm>
 #include <utility>
+#include <atomic>
+#include <deque>
 #include "Node.h"
 #include "Error.h"
+#include "Serialize.h"
 
 
-typedef struct Func {
-    std::vector<std::string> argv;
-    name_table local;
-    Node* body;
-
-    Func(const Func &f);
-
-    Func(std::vector<std::string> as, name_table nt, Node *b);
-} Func;
+struct Func;       //значение-функция, определение - после Value
 
 typedef std::vector<std::vector<Value>> Matrix;
 
@@ -65,20 +60,11 @@ private:
     union {
         double _double_data;
         std::vector<std::vector<Value>> *_matrix_data;
-        Func *_function_data;
+        const Func *_function_data;
     };
 
 public:
 
-    static Value call(const Value &arg, std::vector<Value> arguments, const Coordinate& pos) {
-        Func *f = arg.get_function();
-        size_t sz = f->argv.size();
-        for (size_t i = 0; i < sz; ++i) {
-            f->local[f->argv[i]] = arguments[i];
-        }
-        return f->body->exec(&f->local);
-    }
-
     Value();
 
     Value(std::array<int, 7> dim);
@@ -91,7 +77,7 @@ public:
 
     Value(Matrix m, std::array<int, 7> dim);
 
-    Value(Func *f);
+    explicit Value(const Func *f);     //забирает владение только что созданной функцией
 
     Value(const Value &other);
 
@@ -461,7 +447,11 @@ public:
 
     Matrix& get_matrix() const;
 
-    Func* get_function() const;
+    const Func* get_function() const;
+
+    void save(std::string& out) const;  //сериализация для кэша блоков
+
+    static Value load(Reader& in);
 
     static bool is_equal_dim(const Value &left, const Value &right) {
         for (int i = 0; i < 7; i++) {
@@ -481,7 +471,7 @@ public:
         return true;
     }
 
-    static Value plus(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value plus(const Value &left, const Value &right, size_t pos) {
         if (left._type == DOUBLE || left._type == INFERRED_DOUBLE) { //если right - не DOUBLE, сработает исключение
             return {left.get_double() + right.get_double(), left._dimension};
         } else if (left._type == MATRIX || left._type == INFERRED_MATRIX) {
@@ -502,7 +492,7 @@ public:
         throw Error(pos, "Addition cannot be done");
     }
 
-    static Value usub(const Value &arg, const Coordinate& pos) {
+    static Value usub(const Value &arg, size_t pos) {
         if (arg._type == DOUBLE || arg._type == INFERRED_DOUBLE) {
             return {-arg.get_double(), arg._dimension};
         } else if (arg._type == MATRIX || arg._type == INFERRED_MATRIX) {
@@ -518,7 +508,7 @@ public:
         throw Error(pos, "Substitution cannot be done");
     }
 
-    static Value sub(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value sub(const Value &left, const Value &right, size_t pos) {
         if (left._type == DOUBLE || left._type == INFERRED_DOUBLE) {
             return {left.get_double() - right.get_double(), left._dimension};
         } else if (left._type == MATRIX || left._type == INFERRED_MATRIX) {
@@ -539,7 +529,7 @@ public:
         throw Error(pos, "Substitution cannot be done");
     }
 
-    static Value mul(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value mul(const Value &left, const Value &right, size_t pos) {
         if (left._type == DOUBLE || left._type == INFERRED_DOUBLE) {
             if (right._type == DOUBLE || right._type == INFERRED_DOUBLE) {
                 std::array<int, 7> dim{};
@@ -597,7 +587,7 @@ public:
         throw Error(pos, "Multiplication cannot be done");
     }
 
-    static Value div(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value div(const Value &left, const Value &right, size_t pos) {
         if (left._type == DOUBLE || left._type == INFERRED_DOUBLE) {
             if (right._type == DOUBLE || right._type == INFERRED_DOUBLE) {
                 double q = right.get_double();
@@ -623,7 +613,7 @@ public:
         throw Error(pos, "Division cannot be done");
     }
 
-    static Value eq(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value eq(const Value &left, const Value &right, size_t pos) {
         if (!(
             (left._type == DOUBLE || right._type == INFERRED_DOUBLE) &&
             (right._type == DOUBLE || right._type == INFERRED_DOUBLE)
@@ -654,19 +644,19 @@ public:
         return {0.0, dimensionless};
     }
 
-    static Value le(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value le(const Value &left, const Value &right, size_t pos) {
         return {static_cast<double>(left.get_double() <= right.get_double())};  //иначе не имеет смысла
     }
 
-    static Value ge(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value ge(const Value &left, const Value &right, size_t pos) {
         return {static_cast<double>(left.get_double() >= right.get_double())};
     }
 
-    static Value lt(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value lt(const Value &left, const Value &right, size_t pos) {
         return {static_cast<double>(left.get_double() < right.get_double())};
     }
 
-    static Value gt(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value gt(const Value &left, const Value &right, size_t pos) {
         return {static_cast<double>(left.get_double() > right.get_double())};
     }
 
@@ -678,7 +668,7 @@ public:
         return tmp_dim;
     }
 
-    static Value pow(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value pow(const Value &left, const Value &right, size_t pos) {
         double floor;
 
         if (Value::is_dimensionless(left)) {
@@ -697,15 +687,15 @@ public:
         }
     }
 
-    static Value abs(const Value &right, const Coordinate& pos) {
+    static Value abs(const Value &right, size_t pos) {
         return {std::abs(right.get_double()), right._dimension};
     }
 
-    static Value andd(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value andd(const Value &left, const Value &right, size_t pos) {
         return {static_cast<double>(left.get_double() && right.get_double())};
     }
 
-    static Value orr(const Value &left, const Value &right, const Coordinate& pos) {
+    static Value orr(const Value &left, const Value &right, size_t pos) {
         return {static_cast<double>(left.get_double() || right.get_double())};
     }
 
@@ -798,6 +788,81 @@ public:
     }
 };
 
+
+//глобальные переменные по номерам (Global.cpp). номер имени общий для всех потоков и не меняется до конца работы:
+//его получает узел при разборе (Node::resolve_names), а блок может исполняться в другом потоке.
+//значения у каждой таблицы свои, пустая ячейка - UNDEFINED
+class GlobalTable {
+public:
+    static int slot(const std::string& name);       //номер имени, при первом обращении - новый
+
+    static const std::string& name(int slot);
+
+    const Value *find(int slot) const;              //nullptr - имя не определено
+
+    Value& operator[](int slot);                    //ячейка имени, заводится при первом обращении
+
+    void clear();
+
+    size_t size() const;                            //определенных имен
+
+    //f(имя, значение) для определенных имен в порядке номеров
+    template <class F>
+    void each(F f) const {
+        for (size_t i = 0; i < values_.size(); ++i) {
+            if (values_[i]._type != Value::UNDEFINED) f(name(static_cast<int>(i)), values_[i]);
+        }
+    }
+
+private:
+    std::deque<Value> values_;      //ячейки не переезжают: ссылка на значение живет, пока заводятся новые имена
+};
+
+//значения, захваченные функцией при объявлении, по глобальным номерам имен (Global.cpp).
+//имен немного - только те, что упоминает тело, поэтому хранятся упорядоченным списком
+class Captures {
+public:
+    const Value *find(int slot) const;              //nullptr - имя не захвачено
+
+    void set(int slot, const Value& v);
+
+    size_t size() const;
+
+    //f(имя, значение) в порядке номеров
+    template <class F>
+    void each(F f) const {
+        for (auto& it : values_) {
+            f(GlobalTable::name(it.first), it.second);
+        }
+    }
+
+private:
+    std::vector<std::pair<int, Value>> values_;
+};
+
+//после объявления функция не меняется: копии значения-функции делят один Func по счетчику ссылок,
+//вызов заводит свой кадр (Frame.h) поверх захваченных имен, тело и захваченные имена не копируются
+typedef struct Func {
+    std::vector<std::string> argv;
+    std::vector<std::string> slots;     //ячейки кадра: аргументы, потом локальные имена тела
+    std::vector<int> names;             //глобальный номер имени каждой ячейки кадра
+    std::vector<int> free;              //имена, которые тело может взять не из кадра: их и захватывает объявление
+    Captures local;     //значения free в месте объявления
+    Arena arena;        //тело живет дольше блока, в котором функция объявлена
+    Node* body;
+    mutable std::atomic<size_t> refs{1};    //значения потоков кэша и сервера могут делить функцию
+
+    Func(std::vector<std::string> as, const Node *b = nullptr);  //тело копируется в арену функции
+
+    Func(const Func &f) = delete;
+
+    void bind();    //номера ячеек кадра в узлах тела и список free
+} Func;
+
+void save_table(const Captures& nt, std::string& out);
+
+Captures load_table(Reader& in);
+
 typedef struct Replacement {
     Tag tag;
     size_t begin;
@@ -0,0 +1,185 @@
+#include <iostream>
+#include <chrono>
+#include <climits>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include "Watch.h"
+#include "FileHandler.h"
+#include "Preprocessor.h"
+
+
+Watcher::~Watcher() = default;
+
+void Watcher::drop(std::vector<Block>& blocks, size_t from) {
+    blocks.resize(std::min(from, blocks.size()));
+}
+
+//состояние после последнего из blocks: ближайший снимок и повтор блоков после него
+void Watcher::restore(const std::vector<Block>& blocks) {
+    size_t j = blocks.size();
+    while (j > 0 && !blocks[j - 1].checkpoint) --j;
+    if (j == 0) {
+        Node::global.clear();
+        reset_analysis();
+    } else {
+        Node::global = blocks[j - 1].global;
+        restore_analysis(blocks[j - 1].analysis);
+    }
+    for (; j < blocks.size(); ++j) {
+        Position::ps = blocks[j].ps;
+        Node::reps = blocks[j].reps;
+        eval_block(blocks[j].root, blocks[j].ps);
+    }
+}
+
+void Watcher::add(const std::string& in, const std::string& out) {
+    sources_.push_back({in, out, {}});
+}
+
+//блоки до первого измененного берутся из памяти вместе с состоянием после них,
+//дальше исполняются заново (с разобранными деревьями, если текст и место блока не изменились)
+bool Watcher::update(Source& src) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::string part = temp_name(src.out);  //вывод пишется рядом и подменяется rename
+    FileHandler fh(src.in.c_str(), part.c_str());
+    if (!fh.good()) {
+        std::cerr << src.in << ":" << "Failed to initialize" << std::endl;
+        fh.remove_out();
+        return false;
+    }
+    Position::lines.reset(fh.text());
+
+    std::vector<Block> old = std::move(src.blocks);
+    src.blocks.clear();
+    bool dirty = false;
+    bool ok = true;
+    size_t evaluated = 0;
+    size_t k = 0;
+    size_t since = 0;   //блоков после последнего снимка
+    while (ok) {
+        ProgramString ps = fh.next();
+        if (ps.program.empty()) {
+            break;
+        }
+        Block *prev = (k < old.size()) ? &old[k] : nullptr;
+        ++k;
+        bool same_text = prev && prev->ps.program == ps.program;
+        bool same_place = same_text && prev->ps.offset == ps.offset;
+
+        //ps остается прежним: координаты в дереве блока соответствуют ему
+        if (!dirty && same_text && (same_place || !prev->anchored)) {
+            src.blocks.push_back(std::move(*prev));
+            since = src.blocks.back().checkpoint ? 0 : since + 1;
+            fh.print_to_out(src.blocks.back().replacement);
+            continue;
+        }
+        if (!dirty) {
+            dirty = true;
+            ok = run_reported(src.in.c_str(), [&]() { restore(src.blocks); });
+            if (!ok) break;
+        }
+        Position::ps = ps;
+
+        Block b;
+        b.ps = ps;
+        if (same_place) {
+            b.arena = std::move(prev->arena);
+            b.root = prev->root;
+            b.reps = prev->reps;
+        }
+        ok = run_reported(src.in.c_str(), [&]() {
+            if (!b.root) {
+                Node::reps.clear();
+                b.root = parse_block(ps, *b.arena);
+                b.reps = Node::reps;
+            }
+            Node::reps = b.reps;
+            b.replacement = eval_block(b.root, ps);
+        });
+        if (!ok) {
+            break;
+        }
+        ++evaluated;
+        b.anchored = defines_function(ps);
+        if (++since * 32 > Node::global.size()) {
+            b.checkpoint = true;
+            b.global = Node::global;
+            b.analysis = analysis_state();
+            since = 0;
+        }
+        fh.print_to_out(b.replacement);
+        src.blocks.push_back(std::move(b));
+    }
+    drop(old, 0);
+
+    if (!ok) {
+        fh.remove_out();
+    } else if (!fh.finish() || std::rename(part.c_str(), src.out.c_str())) {
+        std::cerr << "Couldn't rename file: " << part << " to " << src.out << std::endl;
+        std::remove(part.c_str());
+        ok = false;
+    }
+
+    auto diff = std::chrono::steady_clock::now() - start;
+    std::cout << src.in << ": " << (ok ? "ok" : "FAILED") << ", " << evaluated << "/" << k << " blocks evaluated ("
+              << std::chrono::duration<double, std::milli>(diff).count() << " ms)" << std::endl;
+    return ok;
+}
+
+//наблюдаются каталоги: редакторы часто сохраняют файл через переименование временного
+int Watcher::run() {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd == -1) {
+        std::cerr << "inotify_init1 failed" << std::endl;
+        return 1;
+    }
+    std::map<int, std::string> dirs;
+    for (auto& src : sources_) {
+        size_t slash = src.in.rfind('/');
+        std::string dir = (slash == std::string::npos) ? "." : src.in.substr(0, slash + 1);
+        int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd == -1) {
+            std::cerr << dir << ":" << "Couldn't watch directory" << std::endl;
+            close(fd);
+            return 1;
+        }
+        dirs[wd] = dir;
+        update(src);
+    }
+
+    alignas(inotify_event) char buf[64 * (sizeof(inotify_event) + NAME_MAX + 1)];
+    pollfd pfd{fd, POLLIN, 0};
+    for (;;) {
+        std::vector<bool> changed(sources_.size(), false);
+        bool any = false;
+        //за одно сохранение приходит несколько событий: читаем все, что уже пришло
+        for (int timeout = -1; poll(&pfd, 1, timeout) > 0; timeout = 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                close(fd);
+                return 1;
+            }
+            for (char *p = buf; p < buf + n;) {
+                auto ev = reinterpret_cast<inotify_event *>(p);
+                p += sizeof(inotify_event) + ev->len;
+                if (!ev->len) continue;
+                std::string path = dirs[ev->wd] == "." ? ev->name : dirs[ev->wd] + ev->name;
+                for (size_t i = 0; i < sources_.size(); ++i) {
+                    if (sources_[i].in == path) {
+                        changed[i] = true;
+                        any = true;
+                    }
+                }
+            }
+        }
+        if (!any) continue;
+        for (size_t i = 0; i < sources_.size(); ++i) {
+            if (changed[i]) update(sources_[i]);
+        }
+    }
+}
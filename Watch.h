@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "Coordinate.h"
+#include "Node.h"
+#include "basic_HM.h"
+
+
+//режим наблюдения: файлы обрабатываются заново при каждом сохранении.
+//деревья блоков и снимки состояния интерпретатора остаются в памяти,
+//поэтому исполняются только блоки, начиная с первого измененного.
+//снимок делается после каждого блока, пока глобальных имен мало; при большом
+//состоянии - через несколько блоков, чтобы копирование оставалось линейным,
+//а блоки между снимком и изменением исполняются повторно по готовым деревьям
+class Watcher {
+public:
+    Watcher() = default;
+
+    ~Watcher();
+
+    void add(const std::string& in, const std::string& out);
+
+    int run();  //возвращается только при ошибке inotify
+
+    Watcher(Watcher const&) = delete;
+    Watcher& operator=(Watcher const&) = delete;
+
+private:
+    typedef struct Block {
+        ProgramString ps;
+        std::unique_ptr<Arena> arena = std::make_unique<Arena>();  //дерево блока, переходит в следующую версию вместе с root
+        Node *root = nullptr;
+        replacement_map reps;       //замены, сохраненные парсером
+        std::string replacement;
+        bool anchored = false;      //блок определяет функцию, координаты ее тела в состоянии
+        bool checkpoint = false;    //есть снимок состояния после блока
+        GlobalTable global;
+        AnalysisState analysis;
+    } Block;
+
+    typedef struct Source {
+        std::string in;
+        std::string out;
+        std::vector<Block> blocks;
+    } Source;
+
+    std::vector<Source> sources_;
+
+    static void drop(std::vector<Block>& blocks, size_t from);
+
+    static void restore(const std::vector<Block>& blocks);
+
+    bool update(Source& src);
+};
@@ -5,8 +5,13 @@
 #include "set"
 
 #include "basic_HM.h"
+#include "Flat.h"
 
 
+std::string TypeNode::toString() const {
+    return "";
+}
+
 TypeVariable::TypeVariable() = default;
 
 
@@ -28,7 +33,7 @@ bool is_number(const std::string& name) {
 }
 
 
-Node* get_base_type(Node* object) {
+TypeNode* get_base_type(TypeNode* object) {
     auto* type_var = dynamic_cast<TypeVariable*>(object);
 
     if (type_var != nullptr) {
@@ -43,7 +48,7 @@ Node* get_base_type(Node* object) {
 
 
 bool any_type_match(
-    Node* target,
+    TypeNode* target,
     const std::vector<TypeVariable*>& source
 ) {
     for (auto& type : source) {
@@ -58,10 +63,10 @@ bool any_type_match(
 
 
 bool type_match(
-    Node* target,
-    Node* source
+    TypeNode* target,
+    TypeNode* source
 ) {
-    Node* source_base_type = get_base_type(source);
+    TypeNode* source_base_type = get_base_type(source);
 
     if (source_base_type == target) {
         return true;
@@ -76,7 +81,7 @@ bool type_match(
 
 
 bool is_generic_type(
-    Node* target,
+    TypeNode* target,
     const std::vector<TypeVariable *> &source
 ) {
     return !any_type_match(target, source);
@@ -84,11 +89,11 @@ bool is_generic_type(
 
 
 void unification(
-    Node* type1,
-    Node* type2
+    TypeNode* type1,
+    TypeNode* type2
 ) {
-    Node* base_type_1 = get_base_type(type1);
-    Node* base_type_2 = get_base_type(type2);
+    TypeNode* base_type_1 = get_base_type(type1);
+    TypeNode* base_type_2 = get_base_type(type2);
 
     auto* type_var1 = dynamic_cast<TypeVariable*>(base_type_1);
     auto* type_var2 = dynamic_cast<TypeVariable*>(base_type_1);
@@ -128,12 +133,12 @@ void unification(
 }
 
 
-Node* copy_type_rec(
-    Node* type,
+TypeNode* copy_type_rec(
+    TypeNode* type,
     const std::vector<TypeVariable *> &non_generic,
     std::map<TypeVariable*, TypeVariable*> mapping
 ) {
-    Node* base_type = get_base_type(type);
+    TypeNode* base_type = get_base_type(type);
 
     auto* type_var = dynamic_cast<TypeVariable*>(base_type);
     auto* type_op = dynamic_cast<TypeOperator*>(base_type);
@@ -154,7 +159,7 @@ Node* copy_type_rec(
             std::vector<TypeVariable*> new_types;
 
             for (auto& cur_type : type_op->types) {
-                Node* copied_obj = copy_type_rec(cur_type, non_generic, mapping);
+                TypeNode* copied_obj = copy_type_rec(cur_type, non_generic, mapping);
                 auto* copied_type = dynamic_cast<TypeVariable*>(copied_obj);
 
                 if (copied_type != nullptr) {
@@ -172,8 +177,8 @@ Node* copy_type_rec(
 }
 
 
-Node* copy_type(
-    Node* type,
+TypeNode* copy_type(
+    TypeNode* type,
     const std::vector<TypeVariable *> &non_generic
 ) {
     std::map<TypeVariable*, TypeVariable*> mapping;
@@ -182,20 +187,87 @@ Node* copy_type(
 }
 
 
-auto global_idents = name_table();
-auto global_funcs = name_table();
-auto global_funcs_body = std::map<std::string, std::pair<Node*, std::vector<std::pair<std::string, Value>>>>();
+thread_local auto global_idents = name_table();
+thread_local auto global_funcs = name_table();
+thread_local auto global_funcs_body = std::map<std::string, std::pair<Node*, std::vector<std::pair<std::string, Value>>>>();
+
+void reset_analysis() {
+    global_idents.clear();
+    global_funcs.clear();
+    global_funcs_body.clear();
+}
+
+AnalysisState analysis_state() {
+    return {global_idents, global_funcs, global_funcs_body};
+}
+
+void restore_analysis(const AnalysisState& state) {
+    global_idents = state.idents;
+    global_funcs = state.funcs;
+    global_funcs_body = state.funcs_body;
+}
 
+//состояние анализатора по одной записи на имя: i - переменные, f - функции, b - аргументы функций.
+//тела функций анализатору после определения не нужны, сохраняются только аргументы
+void save_analysis(const StateSink& sink) {
+    std::string name, value;
+    for (auto& it : global_idents) {
+        name.assign("i").append(it.first);
+        value.clear();
+        it.second.save(value);
+        sink(name, value);
+    }
+    for (auto& it : global_funcs) {
+        name.assign("f").append(it.first);
+        value.clear();
+        it.second.save(value);
+        sink(name, value);
+    }
+    for (auto& it : global_funcs_body) {
+        name.assign("b").append(it.first);
+        value.clear();
+        put_u64(value, it.second.second.size());
+        for (auto& arg : it.second.second) {
+            put_str(value, arg.first);
+            arg.second.save(value);
+        }
+        sink(name, value);
+    }
+}
+
+void load_analysis(const std::map<std::string, std::string>& image) {
+    reset_analysis();
+    for (auto& it : image) {
+        if (it.first.empty()) continue;
+        Reader in(it.second.data(), it.second.size());
+        std::string name = it.first.substr(1);
+        if (it.first[0] == 'i') {
+            global_idents.emplace(std::move(name), Value::load(in));
+        } else if (it.first[0] == 'f') {
+            global_funcs.emplace(std::move(name), Value::load(in));
+        } else if (it.first[0] == 'b') {
+            std::vector<std::pair<std::string, Value>> args;
+            uint64_t k = in.u64();
+            for (uint64_t j = 0; j < k; ++j) {
+                std::string arg = in.str();
+                args.emplace_back(std::move(arg), Value::load(in));
+            }
+            global_funcs_body.emplace(std::move(name), std::make_pair(static_cast<Node *>(nullptr), std::move(args)));
+        }
+    }
+}
+
+template <class Ref>
 std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
-    Node *node,
+    Ref node,
     bool inside_func_or_block,
     std::vector<std::pair<std::string, Value>> local_vars,
     bool is_usub
 ) {
-    Tag& current_tag = node->get_tag();
+    Tag current_tag = node.tag();
 
     if (current_tag == Tag::NUMBER) {
-        double val = std::stod(node->get_label());
+        double val = node.number();
 
         if (is_usub) {
             val = -val;
@@ -205,7 +277,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     }
 
     if (current_tag == Tag::IDENT) {
-        const auto& ident_name = node->get_label();
+        const auto& ident_name = node.label();
 
         bool founded = false;
         Value val;
@@ -218,32 +290,36 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         }
 
         if (global_idents.count(ident_name) > 0) {
-            return {global_idents[ident_name], local_vars};
-        } else if (inside_func_or_block && founded) {
-            return {val, local_vars};
-        } else {
-            throw std::invalid_argument("IDENT does not exists; node: " + node->toString());
+            val = global_idents[ident_name];
+        } else if (!inside_func_or_block || !founded) {
+            throw std::invalid_argument("IDENT does not exists; node: " + node.label());
+        }
+        //x_{i} и x_{i,j} - элемент: размерность у элементов матрицы общая
+        if (node.size() > 0 && (val._type == Value::MATRIX || val._type == Value::INFERRED_MATRIX)) {
+            Value elem = val.get_matrix()[0][0];
+            return {elem, local_vars};
         }
+        return {val, local_vars};
     }
 
     if (current_tag == Tag::FUNC) {
-        if (global_funcs.count(node->get_label()) > 0) {
-            const auto& func_args = global_funcs_body.find(node->get_label())->second.second;
+        if (global_funcs.count(node.label()) > 0) {
+            const auto& func_args = global_funcs_body.find(node.label())->second.second;
 
-            if (node->fields.size() != func_args.size()) {
+            if (node.size() != func_args.size()) {
                 throw std::invalid_argument(
                         "FUNC has an incorrect amount of args: " +
-                        std::to_string(node->fields.size()) +
+                        std::to_string(node.size()) +
                         " instead of: " +
                         std::to_string(func_args.size()) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
-            for (int i = 0; i < node->fields.size(); i++) {
+            for (int i = 0; i < node.size(); i++) {
                 const auto& calculated = analyse(
-                    node->fields[i],
+                    node.field(i),
                     inside_func_or_block,
                     local_vars,
                     is_usub
@@ -273,36 +349,37 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                             " instead of: " +
                             Value::type_string(expected._type) +
                             " in node: " +
-                            node->toString()
+                            node.label()
                     );
                 }
             }
 
-            return {global_funcs.find(node->get_label())->second, local_vars};
+            return {global_funcs.find(node.label())->second, local_vars};
         } else {
             for (const auto& local_var : local_vars) {
-                if (local_var.first == node->get_label()) {
+                if (local_var.first == node.label()) {
                     return {local_var.second, local_vars};
                 }
             }
         }
 
-        throw std::invalid_argument("FUNC does not exists; node: " + node->toString());
+        throw std::invalid_argument("FUNC does not exists; node: " + node.label());
     }
 
     if (current_tag == Tag::BEGINC) {
-        for (auto option : node->fields) {
-            if (option->cond != nullptr) {
-                Tag cond_tag = option->cond->get_tag();
+        for (size_t k = 0; k < node.size(); ++k) {
+            Ref option = node.field(k);
+            if (option.cond()) {
+                Tag cond_tag = option.cond().tag();
 
                 auto left = analyse(
-                    option->cond->left,
+                    option.cond().left(),
                     inside_func_or_block,
                     local_vars,
                     is_usub
                 );
                 auto right = analyse(
-                    option->cond->right,
+                    option.cond().right(),
                     inside_func_or_block,
                     left.second,
                     is_usub
@@ -310,13 +387,13 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
                 if (
                     left.first._type == Value::UNDEFINED &&
-                    option->cond->left->get_tag() == Tag::IDENT &&
+                    option.cond().left().tag() == Tag::IDENT &&
                     (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE)
                 ) {
                     left.first._type = Value::INFERRED_DOUBLE;
                     left.first._dimension = right.first.get_dimension();
 
-                    const std::string& ident_name = option->cond->left->get_label();
+                    const std::string& ident_name = option.cond().left().label();
 
                     if (global_idents.count(ident_name) > 0) {
                         global_idents[ident_name] = Value(0.0, right.first.get_dimension());
@@ -335,13 +412,13 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
                 if (
                     right.first._type == Value::UNDEFINED &&
-                    option->cond->right->get_tag() == Tag::IDENT &&
+                    option.cond().right().tag() == Tag::IDENT &&
                     (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE)
                 ) {
                     right.first._type = Value::INFERRED_DOUBLE;
                     right.first._dimension = left.first.get_dimension();
 
-                    const std::string& ident_name = option->cond->right->get_label();
+                    const std::string& ident_name = option.cond().right().label();
 
                     if (global_idents.count(ident_name) > 0) {
                         global_idents[ident_name] = Value(0.0, left.first.get_dimension());
@@ -368,7 +445,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                                 "Undefined value: " +
                                 to_string(left.first) +
                                 " in node: " +
-                                option->toString()
+                                option.label()
                         );
                     }
 
@@ -377,7 +454,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                                 "Undefined value: " +
                                 to_string(right.first) +
                                 " in node: " +
-                                option->toString()
+                                option.label()
                         );
                     }
 
@@ -386,7 +463,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                                 "Cannot compare using inferred double value: " +
                                 to_string(left.first) +
                                 " in node: " +
-                                option->toString()
+                                option.label()
                         );
                     }
 
@@ -395,7 +472,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                                 "Cannot compare using inferred double value: " +
                                 to_string(right.first) +
                                 " in node: " +
-                                option->toString()
+                                option.label()
                         );
                     }
 
@@ -405,44 +482,44 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                             " and value: " +
                             to_string(right.first) +
                             " in node: " +
-                            option->toString()
+                            option.label()
                     );
                 }
 
                 switch (cond_tag) {
                     case Tag::GT:
                         if (left.first.get_double() > right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option.right(), inside_func_or_block, right.second, is_usub);
                         } else {
                             continue;
                         }
                     case Tag::GEQ:
                         if (left.first.get_double() >= right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option.right(), inside_func_or_block, right.second, is_usub);
                         } else {
                             continue;
                         }
                     case Tag::LT:
                         if (left.first.get_double() < right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option.right(), inside_func_or_block, right.second, is_usub);
                         } else {
                             continue;
                         }
                     case Tag::LEQ:
                         if (left.first.get_double() <= right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option.right(), inside_func_or_block, right.second, is_usub);
                         } else {
                             continue;
                         }
                     case Tag::EQ:
                         if (left.first.get_double() == right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option.right(), inside_func_or_block, right.second, is_usub);
                         } else {
                             continue;
                         }
                     case Tag::NEQ:
                         if (left.first.get_double() != right.first.get_double()) {
-                            return analyse(option->right, inside_func_or_block, right.second, is_usub);
+                            return analyse(option.right(), inside_func_or_block, right.second, is_usub);
                         } else {
                             continue;
                         }
@@ -455,21 +532,21 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                                 " and value: " +
                                 to_string(right.first) +
                                 " in node: " +
-                                option->toString()
+                                option.label()
                         );
                 }
             } else {
-                return analyse(option->right, inside_func_or_block, local_vars, is_usub);
+                return analyse(option.right(), inside_func_or_block, local_vars, is_usub);
             }
         }
     }
 
     if (current_tag == Tag::UADD || current_tag == Tag::NOT || current_tag == Tag::LPAREN) {
-        return analyse(node->right, inside_func_or_block, local_vars, is_usub);
+        return analyse(node.right(), inside_func_or_block, local_vars, is_usub);
     }
 
     if (current_tag == Tag::USUB) {
-        return analyse(node->right, inside_func_or_block, local_vars, true);
+        return analyse(node.right(), inside_func_or_block, local_vars, true);
     }
 
     if (
@@ -481,20 +558,20 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         current_tag == Tag::LEQ ||
         current_tag == Tag::GT ||
         current_tag == Tag::GEQ ||
-        (current_tag == Tag::EQ && node->right->get_tag() != Tag::PLACEHOLDER) ||
+        (current_tag == Tag::EQ && node.right().tag() != Tag::PLACEHOLDER) ||
         current_tag == Tag::NEQ
     ) {
-        auto left = analyse(node->left, inside_func_or_block, local_vars, is_usub);
-        auto right = analyse(node->right, inside_func_or_block, left.second, is_usub);
+        auto left = analyse(node.left(), inside_func_or_block, local_vars, is_usub);
+        auto right = analyse(node.right(), inside_func_or_block, left.second, is_usub);
 
         if (
             left.first._type == Value::UNDEFINED &&
-            node->left->get_tag() == Tag::IDENT &&
+            node.left().tag() == Tag::IDENT &&
             (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE)
         ) {
             left.first._type = Value::INFERRED_DOUBLE;
             left.first._dimension = right.first.get_dimension();
-            const std::string& ident_name = node->left->get_label();
+            const std::string& ident_name = node.left().label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(0.0, right.first.get_dimension());
@@ -513,12 +590,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
         if (
             left.first._type == Value::UNDEFINED &&
-            node->left->get_tag() == Tag::IDENT &&
+            node.left().tag() == Tag::IDENT &&
             (right.first._type == Value::MATRIX || right.first._type == Value::INFERRED_MATRIX)
         ) {
             left.first._type = Value::INFERRED_MATRIX;
             left.first._dimension = right.first.get_dimension();
-            const std::string& ident_name = node->left->get_label();
+            const std::string& ident_name = node.left().label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(right.first.get_matrix());
@@ -535,12 +612,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
         if (
             right.first._type == Value::UNDEFINED &&
-            node->right->get_tag() == Tag::IDENT &&
+            node.right().tag() == Tag::IDENT &&
             (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE)
         ) {
             right.first._type = Value::INFERRED_DOUBLE;
             right.first._dimension = left.first.get_dimension();
-            const std::string& ident_name = node->right->get_label();
+            const std::string& ident_name = node.right().label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(0.0, left.first.get_dimension());
@@ -559,12 +636,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
         if (
             right.first._type == Value::UNDEFINED &&
-            node->left->get_tag() == Tag::IDENT &&
+            node.left().tag() == Tag::IDENT &&
             (left.first._type == Value::MATRIX || left.first._type == Value::INFERRED_MATRIX)
         ) {
             right.first._type = Value::INFERRED_MATRIX;
             right.first._dimension = left.first.get_dimension();
-            const std::string& ident_name = node->left->get_label();
+            const std::string& ident_name = node.left().label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(left.first.get_matrix());
@@ -594,7 +671,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         "Undefined value: " +
                         to_string(left.first) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
@@ -603,7 +680,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         "Undefined value: " +
                         to_string(right.first) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
@@ -613,7 +690,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                     " and value: " +
                     to_string(right.first) +
                     " in node: " +
-                    node->toString()
+                    node.label()
             );
         }
 
@@ -621,16 +698,16 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     }
 
     if (current_tag == Tag::MUL || current_tag == Tag::DIV || current_tag == Tag::FRAC) {
-        auto left = analyse(node->left, inside_func_or_block, local_vars, is_usub);
-        auto right = analyse(node->right, inside_func_or_block, left.second, is_usub);
+        auto left = analyse(node.left(), inside_func_or_block, local_vars, is_usub);
+        auto right = analyse(node.right(), inside_func_or_block, left.second, is_usub);
 
         if (
             left.first._type == Value::UNDEFINED &&
-            node->left->get_tag() == Tag::IDENT &&
+            node.left().tag() == Tag::IDENT &&
             (right.first._type == Value::DOUBLE || right.first._type == Value::INFERRED_DOUBLE)
         ) {
             left.first._type = Value::INFERRED_DOUBLE;
-            const std::string& ident_name = node->left->get_label();
+            const std::string& ident_name = node.left().label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(0.0);
@@ -649,12 +726,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
         if (
             left.first._type == Value::UNDEFINED &&
-            node->left->get_tag() == Tag::IDENT &&
+            node.left().tag() == Tag::IDENT &&
             (right.first._type == Value::MATRIX || right.first._type == Value::INFERRED_MATRIX)
         ) {
             left.first._type = Value::INFERRED_MATRIX;
             left.first._dimension = right.first.get_dimension();
-            const std::string& ident_name = node->left->get_label();
+            const std::string& ident_name = node.left().label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(right.first.get_matrix());
@@ -671,11 +748,11 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
         if (
             right.first._type == Value::UNDEFINED &&
-            node->right->get_tag() == Tag::IDENT &&
+            node.right().tag() == Tag::IDENT &&
             (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE)
         ) {
             right.first._type = Value::INFERRED_DOUBLE;
-            const std::string& ident_name = node->right->get_label();
+            const std::string& ident_name = node.right().label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(0.0);
@@ -694,12 +771,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
         if (
             right.first._type == Value::UNDEFINED &&
-            node->left->get_tag() == Tag::IDENT &&
+            node.left().tag() == Tag::IDENT &&
             (left.first._type == Value::MATRIX || left.first._type == Value::INFERRED_MATRIX)
         ) {
             right.first._type = Value::INFERRED_MATRIX;
             right.first._dimension = left.first.get_dimension();
-            const std::string& ident_name = node->left->get_label();
+            const std::string& ident_name = node.left().label();
 
             if (global_idents.count(ident_name) > 0) {
                 global_idents[ident_name] = Value(left.first.get_matrix());
@@ -728,7 +805,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         "Undefined value: " +
                         to_string(left.first) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
@@ -737,7 +814,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         "Undefined value: " +
                         to_string(right.first) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
@@ -747,7 +824,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                     " and value: " +
                     to_string(right.first) +
                     " in node: " +
-                    node->toString()
+                    node.label()
             );
         }
 
@@ -775,8 +852,8 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     }
 
     if (current_tag == Tag::POW) {
-        auto left = analyse(node->left, inside_func_or_block, local_vars, is_usub);
-        auto right = analyse(node->right, inside_func_or_block, left.second, is_usub);
+        auto left = analyse(node.left(), inside_func_or_block, local_vars, is_usub);
+        auto right = analyse(node.right(), inside_func_or_block, left.second, is_usub);
 
         if (!(
             (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE) &&
@@ -790,7 +867,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         "Undefined value: " +
                         to_string(left.first) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
@@ -799,7 +876,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         "Undefined value: " +
                         to_string(right.first) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
@@ -809,7 +886,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                     " and value: " +
                     to_string(right.first) +
                     " in node: " +
-                    node->toString()
+                    node.label()
             );
         }
 
@@ -820,9 +897,13 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     }
 
     if (current_tag == Tag::SUM || current_tag == Tag::PRODUCT) {
-        auto left = analyse(node->left, inside_func_or_block, local_vars, is_usub);
-        auto cond = analyse(node->cond, inside_func_or_block, left.second, is_usub);
-        auto right = analyse(node->right, inside_func_or_block, cond.second, is_usub);
+        auto left = analyse(node.left(), inside_func_or_block, local_vars, is_usub);
+        auto cond = analyse(node.cond(), inside_func_or_block, left.second, is_usub);
+
+        //счетчик - безразмерная локальная переменная тела
+        auto body_vars = cond.second;
+        body_vars.emplace_back(node.label(), Value(0.0, Value::dimensionless));
+        auto right = analyse(node.right(), true, body_vars, is_usub);
 
         if (!(
             (left.first._type == Value::DOUBLE || left.first._type == Value::INFERRED_DOUBLE) &&
@@ -835,7 +916,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         "Undefined value: " +
                         to_string(left.first) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
@@ -844,7 +925,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         "Undefined value: " +
                         to_string(right.first) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
@@ -854,32 +935,30 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                     " and value: " +
                     to_string(cond.first) +
                     " in node: " +
-                    node->toString()
+                    node.label()
             );
         }
 
         if (current_tag == Tag::SUM) {
-            return analyse(node->right, inside_func_or_block, local_vars, is_usub);
+            return {right.first, cond.second};
         } else {
+            double n = floor(cond.first.get_double() - left.first.get_double()) + 1;
             return {
-                Value::mul_dimensions(
-                    right.first.get_dimension(),
-                    floor(cond.first.get_double() - left.first.get_double())
-                ),
-                right.second
+                Value::mul_dimensions(right.first.get_dimension(), n > 0 ? (int) n : 0),
+                cond.second
             };
         }
     }
 
     if (current_tag == Tag::DIMENSION) {
         return {
-            {dimensions.find(node->get_label())->second},
+            {node.dimension()},
             local_vars
         };
     }
 
     if (current_tag == Tag::ABS) {
-        auto right = analyse(node->right, inside_func_or_block, local_vars, is_usub);
+        auto right = analyse(node.right(), inside_func_or_block, local_vars, is_usub);
 
         if (right.first._type != Value::DOUBLE && right.first._type != Value::INFERRED_DOUBLE) {
             if (right.first._type == Value::UNDEFINED) {
@@ -887,7 +966,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                         "Undefined value: " +
                         to_string(right.first) +
                         " in node: " +
-                        node->toString()
+                        node.label()
                 );
             }
 
@@ -895,7 +974,7 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
                     "Cannot use ABS operator on non double value: " +
                     to_string(right.first) +
                     " in node: " +
-                    node->toString()
+                    node.label()
             );
         }
 
@@ -903,23 +982,23 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     }
 
     if (current_tag == Tag::EQ) {
-        if (node->right->get_tag() != Tag::PLACEHOLDER) {
-            return analyse(node->right, inside_func_or_block, local_vars, is_usub);
+        if (node.right().tag() != Tag::PLACEHOLDER) {
+            return analyse(node.right(), inside_func_or_block, local_vars, is_usub);
         } else {
-            return analyse(node->left, inside_func_or_block, local_vars, is_usub);
+            return analyse(node.left(), inside_func_or_block, local_vars, is_usub);
         }
     }
 
     if (current_tag == Tag::SET) {
         if (inside_func_or_block) {
-            const std::string& ident_name = node->left->get_label();
+            const std::string& ident_name = node.left().label();
 
 //            if (global_idents.count(ident_name) > 0) {
 //                throw std::invalid_argument(
 //                        "Local ident with name: " +
 //                        ident_name +
 //                        " is already exists in global scope, node: " +
-//                        node->toString()
+//                        node.label()
 //                );
 //            }
 //
@@ -929,12 +1008,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 //                            "Local ident with name: " +
 //                            ident_name +
 //                            " is already exists in local scope, node: " +
-//                            node->toString()
+//                            node.label()
 //                    );
 //                }
 //            }
 
-            const auto& res = analyse(node->right, inside_func_or_block, local_vars, is_usub);
+            const auto& res = analyse(node.right(), inside_func_or_block, local_vars, is_usub);
 
             for (int i = 0; i < local_vars.size(); i++) {
                 if (local_vars[i].first == ident_name) {
@@ -947,66 +1026,67 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
             return {res.first, local_vars};
         } else {
-            if (node->left->get_tag() == Tag::IDENT) {
-                const std::string& ident_name = node->left->get_label();
+            if (node.left().tag() == Tag::IDENT) {
+                const std::string& ident_name = node.left().label();
 
 //                if (global_idents.count(ident_name) > 0) {
 //                    throw std::invalid_argument(
 //                            "Global ident with name: " +
 //                            ident_name +
 //                            " is already exists, node: " +
-//                            node->toString()
+//                            node.label()
 //                    );
 //                }
 
                 global_idents.emplace(
                     ident_name,
-                    analyse(node->right, inside_func_or_block, local_vars, is_usub).first
+                    analyse(node.right(), inside_func_or_block, local_vars, is_usub).first
                 );
 
                 return {
                     Value(),
                     local_vars
                 };
-            } else if (node->left->get_tag() == Tag::FUNC) {
+            } else if (node.left().tag() == Tag::FUNC) {
                 std::vector<std::pair<std::string, Value>> res;
-                for (const auto field : node->left->fields) {
-                    if (field->get_tag() != Tag::IDENT) {
+                for (size_t k = 0; k < node.left().size(); ++k) {
+                    Ref field = node.left().field(k);
+                    if (field.tag() != Tag::IDENT) {
                         throw std::invalid_argument(
                                 "FUNC arg is not an IDENT: " +
-                                field->toString() +
+                                field.label() +
                                 " , node: " +
-                                node->toString()
+                                node.label()
                         );
                     }
 
                     for (const auto& arg : res) {
-                        if (arg.first == field->get_label()) {
+                        if (arg.first == field.label()) {
                             throw std::invalid_argument(
                                     "FUNC arg is already exists: " +
-                                    field->toString() +
+                                    field.label() +
                                     " , node: " +
-                                    node->toString()
+                                    node.label()
                             );
                         }
                     }
 
-                    res.emplace_back(field->get_label(), Value());
+                    res.emplace_back(field.label(), Value());
                 }
 
                 const auto& to_return = analyse(
-                    node->right,
+                    node.right(),
                     true,
                     res,
                     is_usub
                 );
 
-                global_funcs.emplace(node->left->get_label(), to_return.first);
+                global_funcs.emplace(node.left().label(), to_return.first);
 
                 global_funcs_body.emplace(
-                        node->left->get_label(),
+                        node.left().label(),
                         std::pair<Node*, std::vector<std::pair<std::string, Value>>>(
-                            node->right,
+                            node.right().node(),
                             std::vector<std::pair<std::string, Value>>(
                                     to_return.second.begin(),
                                     to_return.second.begin() + (long) res.size()
@@ -1016,18 +1096,18 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
 
                 return to_return;
             } else {
-                throw std::invalid_argument("Cannot analyse SET statement: " + node->toString());
+                throw std::invalid_argument("Cannot analyse SET statement: " + node.label());
             }
         }
     }
 
     if (current_tag == Tag::BEGINB) {
-        for (int i = 0; i < node->fields.size(); ++i) {
-            if (i == node->fields.size() - 1) {
-                return analyse(node->fields[i], true, local_vars, is_usub);
+        for (int i = 0; i < node.size(); ++i) {
+            if (i == node.size() - 1) {
+                return analyse(node.field(i), true, local_vars, is_usub);
             } else {
                 const auto& res = analyse(
-                    node->fields[i],
+                    node.field(i),
                     true,
                     local_vars,
                     is_usub
@@ -1041,23 +1121,25 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         Matrix m;
         Value x;
 
-        if (!node->fields.empty() && !node->fields[0]->fields.empty()) {
-            x = analyse(node->fields[0]->fields[0], inside_func_or_block, local_vars, is_usub).first;
+        if (node.size() != 0 && node.field(0).size() != 0) {
+            x = analyse(node.field(0).field(0), inside_func_or_block, local_vars, is_usub).first;
         }
 
-        for (const auto& field : node->fields) {
-            std::vector<Value> v;
-            for (const auto& jt : field->fields) {
-                v.push_back(x);
-            }
-            m.push_back(v);
+        for (size_t i = 0; i < node.size(); ++i) {
+            m.emplace_back(node.field(i).size(), x);
         }
         return {Value(m), local_vars};
     }
 
+    if (current_tag == Tag::PMATRIX) {
+        const NumericMatrix& n = node.numbers();
+        Value x(n.data[0], Value::dimensionless);
+        return {Value(Matrix(n.rows, std::vector<Value>(n.cols, x))), local_vars};
+    }
+
     if (current_tag == Tag::WHILE) {
-        analyse(node->cond, inside_func_or_block, local_vars, is_usub);
-        return analyse(node->right, inside_func_or_block, local_vars, is_usub);
+        analyse(node.cond(), inside_func_or_block, local_vars, is_usub);
+        return analyse(node.right(), inside_func_or_block, local_vars, is_usub);
     }
 
     if (
@@ -1081,12 +1163,12 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
     }
 
     if (current_tag == Tag::IF) {
-        const auto& res = analyse(node->cond, inside_func_or_block, local_vars, is_usub);
-        return analyse(node->right, inside_func_or_block, res.second, is_usub);
+        const auto& res = analyse(node.cond(), inside_func_or_block, local_vars, is_usub);
+        return analyse(node.right(), inside_func_or_block, res.second, is_usub);
     }
 
     if (current_tag == Tag::TRANSP) {
-        const auto& res = analyse(node->left, inside_func_or_block, local_vars, is_usub);
+        const auto& res = analyse(node.left(), inside_func_or_block, local_vars, is_usub);
 
         return {
             Value::transpose(res.first),
@@ -1094,5 +1176,11 @@ std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
         };
     }
 
-    throw std::invalid_argument("Cannot analyse node: " + node->toString());
-}
\ No newline at end of file
+    throw std::invalid_argument("Cannot analyse node: " + node.label());
+}
+
+template std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
+    NodeRef, bool, std::vector<std::pair<std::string, Value>>, bool);
+
+template std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
+    FlatTree::Ref, bool, std::vector<std::pair<std::string, Value>>, bool);
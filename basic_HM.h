@@ -12,15 +12,24 @@
 #include "Value.h"
 
 
-class TypeVariable: public Node {
+//выражение типа для унификации: с деревом программы не связано, поэтому и не Node
+class TypeNode {
 public:
-    Node* instance;
+    virtual ~TypeNode() = default;
+
+    virtual std::string toString() const;
+};
+
+
+class TypeVariable: public TypeNode {
+public:
+    TypeNode* instance = nullptr;
 
     TypeVariable();
 };
 
 
-class TypeOperator: public Node {
+class TypeOperator: public TypeNode {
 public:
     std::string name;
     std::vector<TypeVariable*> types;
@@ -30,26 +39,45 @@ public:
 
 bool is_number(const std::string& name);
 
-Node* get_base_type(Node* object);
+TypeNode* get_base_type(TypeNode* object);
 
-bool any_type_match(Node* target, const std::vector<TypeVariable*>& source);
+bool any_type_match(TypeNode* target, const std::vector<TypeVariable*>& source);
 
-bool type_match(Node* target, Node* source);
+bool type_match(TypeNode* target, TypeNode* source);
 
-bool is_generic_type(Node* target, const std::vector<TypeVariable *> &source);
+bool is_generic_type(TypeNode* target, const std::vector<TypeVariable *> &source);
 
-void unification(Node* type1, Node* type2);
+void unification(TypeNode* type1, TypeNode* type2);
 
-Node* copy_type_rec(
-        Node* type,
+TypeNode* copy_type_rec(
+        TypeNode* type,
         const std::vector<TypeVariable *> &non_generic,
         std::map<TypeVariable*, TypeVariable*> mapping
 );
 
-Node* copy_type(Node* type, const std::vector<TypeVariable *> &non_generic);
+TypeNode* copy_type(TypeNode* type, const std::vector<TypeVariable *> &non_generic);
+
+void reset_analysis();
+
+//снимок состояния анализатора (тела функций не копируются - ими владеют деревья блоков)
+typedef struct AnalysisState {
+    name_table idents;
+    name_table funcs;
+    std::map<std::string, std::pair<Node*, std::vector<std::pair<std::string, Value>>>> funcs_body;
+} AnalysisState;
+
+AnalysisState analysis_state();
+
+void restore_analysis(const AnalysisState& state);
+
+void save_analysis(const StateSink& sink);
+
+void load_analysis(const std::map<std::string, std::string>& image);
 
+//проверка размерностей узла; Ref - NodeRef или FlatTree::Ref
+template <class Ref>
 std::pair<Value, std::vector<std::pair<std::string, Value>>> analyse(
-    Node *node,
+    Ref node,
     bool inside_func_or_block,
     std::vector<std::pair<std::string, Value>> local_vars,
     bool is_usub
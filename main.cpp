@@ -6,46 +6,486 @@
 #include "Lexer.h"
 #include "Node.h"
 #include "Value.h"
+#include "ThreadPool.h"
+#include "Preprocessor.h"
+#include "Document.h"
+#include "Cache.h"
+#include "Watch.h"
+#include "Pipeline.h"
+#include "Server.h"
+#include "Flat.h"
+#include "Frame.h"
+#include "Perf.h"
+#include "basic_HM.h"
 #include <ctime>
 #include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <sys/resource.h>
 
 
-ProgramString Position::ps;
-name_table Node::global;
-replacement_map Node::reps;
+thread_local ProgramString Position::ps;
+thread_local LineIndex Position::lines;
+thread_local Symbols Token::symbols;
+thread_local GlobalTable Node::global;
+thread_local replacement_map Node::reps;
 
+static std::unique_ptr<BlockCache> cache;   //--cache, общий для всех режимов
 
-std::string make_replacement(const std::string& prog, const replacement_map& m) {
-	std::string res;
-	size_t index = 0;
 
-//	std::cout << "make_replacement.size = " << m.size() << std::endl;
+//--cache path и --cache-size MB убираются из argv, остальные аргументы разбираются режимами
+bool open_cache(int &argc, char *argv[]) {
+	const char *path = nullptr;
+	size_t mb = 64;
+	int n = 1;
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "--cache") && i + 1 < argc) {
+			path = argv[++i];
+		} else if (!std::strcmp(argv[i], "--cache-size") && i + 1 < argc) {
+			mb = std::strtoul(argv[++i], nullptr, 10);
+		} else {
+			argv[n++] = argv[i];
+		}
+	}
+	argc = n;
+	argv[argc] = nullptr;
+	if (!path) return true;
+	cache = std::make_unique<BlockCache>(path, mb << 20);
+	if (!cache->good()) {
+		std::cerr << path << ":" << "Couldn't open cache" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void report_cache() {
+	if (cache) {
+		std::cout << "cache: " << cache->hits() << " hits, " << cache->misses() << " misses" << std::endl;
+	}
+}
+
 
-	for (auto& it : m) {
-		res += prog.substr(index, it.second.begin - index);
-		if (it.second.tag == GRAPHIC) {
-			res += "{" + to_plot(it.second.replacement) + "}";
+//аргумент пакетного режима: файл, каталог (все .tex в нем) или @файл со списком путей
+void collect_inputs(const std::string& arg, std::vector<std::string>& files) {
+	namespace fs = std::filesystem;
+	if (!arg.empty() && arg[0] == '@') {
+		std::ifstream list(arg.substr(1));
+		if (!list) {
+			std::cerr << arg.substr(1) << ":" << "Couldn't open response file" << std::endl;
 		}
-		else {
-//		    std::cout << "second.replacement = " << to_string((*it).second.replacement) << std::endl;
-			res += "{" + to_string(it.second.replacement) + "}";
+		std::string line;
+		while (std::getline(list, line)) {
+			line.erase(0, line.find_first_not_of(" \t\r"));
+			line.erase(line.find_last_not_of(" \t\r") + 1);
+			if (!line.empty() && line[0] != '#') {
+				collect_inputs(line, files);
+			}
+		}
+	} else if (fs::is_directory(arg)) {
+		std::vector<std::string> found;
+		for (auto& entry : fs::recursive_directory_iterator(arg)) {
+			std::string name = entry.path().filename().string();
+			if (entry.is_regular_file() && entry.path().extension() == ".tex" && name[0] != '_') {
+				found.push_back(entry.path().string());
+			}
+		}
+		std::sort(found.begin(), found.end());
+		files.insert(files.end(), found.begin(), found.end());
+	} else {
+		files.push_back(arg);
+	}
+}
+
+//пакетный режим: файлы перезаписываются, как при запуске с одним аргументом
+int run_batch(int argc, char *argv[]) {
+	auto start = std::chrono::steady_clock::now();
+
+	size_t jobs = 0;
+	std::vector<std::string> files;
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-j") && i + 1 < argc) {
+			jobs = std::strtoul(argv[++i], nullptr, 10);
+		} else {
+			collect_inputs(argv[i], files);
+		}
+	}
+	if (files.empty()) {
+		std::cerr << "Usage: " << argv[0] << " --batch [-j N] (file | dir | @list)..." << std::endl;
+		return 2;
+	}
+
+	typedef struct Result {
+		bool ok;
+		double ms;
+	} Result;
+
+	std::vector<std::future<Result>> results;
+	{
+		ThreadPool pool(std::min(jobs ? jobs : std::thread::hardware_concurrency(), files.size()));
+		for (auto& file : files) {
+			results.push_back(pool.submit([&file]() {
+				auto t = std::chrono::steady_clock::now();
+				std::string out = temp_name(file);
+				bool ok = process_file(file.c_str(), out.c_str(), true, cache.get());
+				auto d = std::chrono::steady_clock::now() - t;
+				return Result{ok, std::chrono::duration<double, std::milli>(d).count()};
+			}));
+		}
+	}
+
+	size_t failed = 0;
+	double total = 0;
+	for (size_t i = 0; i < files.size(); ++i) {
+		Result r = results[i].get();
+		total += r.ms;
+		if (!r.ok) ++failed;
+		std::cout << files[i] << ": " << (r.ok ? "ok" : "FAILED") << " (" << r.ms << " ms)" << std::endl;
+	}
+
+	auto diff = std::chrono::steady_clock::now() - start;
+	std::cout << files.size() << " files, " << files.size() - failed << " ok, " << failed << " failed; "
+	          << std::chrono::duration<double, std::milli>(diff).count() << " ms wall, "
+	          << total << " ms in workers" << std::endl;
+	report_cache();
+
+	return failed ? 1 : 0;
+}
+
+//корневой документ и все подключенные в нем файлы, файлы перезаписываются
+int run_document(int argc, char *argv[]) {
+	auto start = std::chrono::steady_clock::now();
+
+	size_t jobs = 0;
+	const char *root = nullptr;
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-j") && i + 1 < argc) {
+			jobs = std::strtoul(argv[++i], nullptr, 10);
+		} else {
+			root = argv[i];
+		}
+	}
+	if (!root) {
+		std::cerr << "Usage: " << argv[0] << " --follow-includes [-j N] root.tex" << std::endl;
+		return 2;
+	}
+
+	Document doc(root, jobs, cache.get());
+	bool ok = doc.process();
+
+	auto diff = std::chrono::steady_clock::now() - start;
+	std::cout << doc.files() << " files" << (ok ? "" : ", FAILED") << "; "
+	          << std::chrono::duration<double, std::milli>(diff).count() << " ms" << std::endl;
+	report_cache();
+	return ok ? 0 : 1;
+}
+
+//режим наблюдения: входные файлы не перезаписываются, вывод идет в _file (или в -o для одного файла)
+int run_watch(int argc, char *argv[]) {
+	const char *out = nullptr;
+	std::vector<std::string> files;
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-o") && i + 1 < argc) {
+			out = argv[++i];
+		} else {
+			files.push_back(argv[i]);
+		}
+	}
+	if (files.empty() || (out && files.size() > 1)) {
+		std::cerr << "Usage: " << argv[0] << " --watch [-o output] file..." << std::endl;
+		return 2;
+	}
+
+	Watcher w;
+	for (auto& file : files) {
+		w.add(file, out ? out : temp_name(file));
+	}
+	return w.run();
+}
+
+//один файл конвейером; аргументы как в обычном режиме, статистика стадий в stderr
+int run_pipeline(int argc, char *argv[]) {
+	auto start = std::chrono::steady_clock::now();
+
+	size_t depth = 64;
+	std::vector<std::string> args;
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-q") && i + 1 < argc) {
+			depth = std::strtoul(argv[++i], nullptr, 10);
+		} else {
+			args.push_back(argv[i]);
+		}
+	}
+	if (args.empty() || args.size() > 2 || depth == 0) {
+		std::cerr << "Usage: " << argv[0] << " --pipeline [-q depth] input [output]" << std::endl;
+		return 2;
+	}
+	bool replace = args.size() == 1 || args[0] == args[1];
+	std::string file_out = replace ? temp_name(args[0]) : args[1];
+
+	bool ok = process_file_pipelined(args[0].c_str(), file_out.c_str(), replace, depth);
+
+	auto diff = std::chrono::steady_clock::now() - start;
+	std::cout << std::chrono::duration<double, std::milli>(diff).count() << std::endl;
+	return ok ? 0 : 1;
+}
+
+//один файл с памятью, ограниченной окном (-w MB, по умолчанию 16); пик RSS в stderr
+int run_stream(int argc, char *argv[]) {
+	auto start = std::chrono::steady_clock::now();
+
+	size_t window = 16;
+	std::vector<std::string> args;
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-w") && i + 1 < argc) {
+			window = std::strtoul(argv[++i], nullptr, 10);
+		} else {
+			args.push_back(argv[i]);
+		}
+	}
+	if (args.empty() || args.size() > 2 || window == 0) {
+		std::cerr << "Usage: " << argv[0] << " --stream [-w window-MB] input [output]" << std::endl;
+		return 2;
+	}
+	bool replace = args.size() == 1 || args[0] == args[1];
+	std::string file_out = replace ? temp_name(args[0]) : args[1];
+
+	bool ok = process_file_streaming(args[0].c_str(), file_out.c_str(), replace, window << 20);
+
+	auto diff = std::chrono::steady_clock::now() - start;
+	struct rusage ru{};
+	getrusage(RUSAGE_SELF, &ru);
+	std::cout << std::chrono::duration<double, std::milli>(diff).count() << std::endl;
+	std::cerr << args[0] << ": peak RSS " << ru.ru_maxrss << " KB" << std::endl;
+	return ok ? 0 : 1;
+}
+
+//сервер: запросы JSON по строкам из сокета или из stdin ("-"), состояние живет между запросами
+int run_serve(int argc, char *argv[]) {
+	if (argc != 3) {
+		std::cerr << "Usage: " << argv[0] << " --serve (socket-path | -)" << std::endl;
+		return 2;
+	}
+	Server server(cache.get());
+	if (!std::strcmp(argv[2], "-")) {
+		return server.serve_stdio();
+	}
+	return server.serve_socket(argv[2]);
+}
+
+static void fnv_mix(uint64_t& hash, const void *p, size_t n) {
+	for (size_t k = 0; k < n; ++k) {
+		hash = (hash ^ static_cast<const unsigned char *>(p)[k]) * 1099511628211ULL;
+	}
+}
+
+//замер исполнения в двух раскладках дерева: блоки разбираются один раз, потом -n раз проходят
+//анализ размерностей и exec по дереву указателей и по плоским массивам (FlatTree);
+//отпечаток - подстановки всех блоков, у обеих раскладок он должен совпасть
+static int bench_exec(const char *file, const std::vector<ProgramString>& blocks, size_t bytes, size_t rounds) {
+	Arena arena;
+	std::vector<Node *> trees;
+	std::vector<FlatTree> flat;
+	std::vector<replacement_map> places;     //места подстановок находит парсер, у каждого блока свои
+	bool ok = run_reported(file, [&]() {
+		for (auto& ps : blocks) {
+			trees.push_back(parse_block(ps, arena));
+			flat.emplace_back(trees.back());
+			places.push_back(std::move(Node::reps));
+			Node::reps.clear();
 		}
-		index = it.second.end;
+	});
+	if (!ok) return 1;
+	size_t nodes = 0;
+	for (auto& f : flat) nodes += f.size();
+
+	//все блоки файла с чистым состоянием интерпретатора; hash - отпечаток подстановок
+	auto pass = [&](bool use_flat, uint64_t *hash) {
+		Node::global.clear();
+		Node::reps.clear();
+		reset_analysis();
+		for (size_t i = 0; i < blocks.size(); ++i) {
+			if (hash) Node::reps = places[i];
+			if (use_flat) {
+				flat[i].semantic_analysis();
+				flat[i].exec({});
+			} else {
+				trees[i]->semantic_analysis();
+				trees[i]->exec({});
+			}
+			if (hash) {
+				std::string replacement = make_replacement(blocks[i].program, Node::reps);
+				fnv_mix(*hash, replacement.data(), replacement.size());
+			}
+			Node::reps.clear();
+		}
+	};
+
+	uint64_t tree_hash = 14695981039346656037ULL, flat_hash = tree_hash;
+	ok = run_reported(file, [&]() {
+		pass(false, &tree_hash);
+		pass(true, &flat_hash);
+	});
+	if (!ok) return 1;
+	if (tree_hash != flat_hash) {
+		std::cerr << file << ": flat layout gives different output" << std::endl;
+		return 1;
 	}
-	res += prog.substr(index);
-	return res;
+
+	std::cout << blocks.size() << " blocks, " << bytes << " bytes, " << nodes << " nodes" << std::endl;
+	CacheCounters counters;
+	for (bool use_flat : {false, true}) {
+		double s = 0;
+		size_t calls = Frame::calls();
+		ok = run_reported(file, [&]() {
+			counters.start();
+			auto start = std::chrono::steady_clock::now();
+			for (size_t r = 0; r < rounds; ++r) {
+				pass(use_flat, nullptr);
+			}
+			s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			counters.stop();
+		});
+		if (!ok) return 1;
+		std::cout << (use_flat ? "flat: " : "tree: ") << s * 1e3 / rounds << " ms/round, ";
+		if (counters.available()) {
+			std::cout << counters.misses() / rounds << " cache misses, "
+			          << counters.l1d_misses() / rounds << " L1d read misses per round" << std::endl;
+		} else {
+			std::cout << "cache misses n/a (" << counters.error() << ")" << std::endl;
+		}
+		calls = (Frame::calls() - calls) / rounds;
+		if (calls) {
+			std::cout << "      " << calls << " calls per round, " << s * 1e9 / rounds / calls << " ns/call" << std::endl;
+		}
+	}
+	std::cout << "fingerprint " << std::hex << tree_hash << std::dec << std::endl;
+	return 0;
+}
+
+//замер лексера или лексера с парсером: все блоки файла разбираются -n раз (по умолчанию 20);
+//отпечаток потока токенов или сохраненных деревьев позволяет сравнить вывод двух версий.
+//exec - замер исполнения (bench_exec)
+int run_bench(int argc, char *argv[]) {
+	size_t rounds = 20;
+	const char *what = nullptr;
+	const char *file = nullptr;
+	for (int i = 2; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-n") && i + 1 < argc) {
+			rounds = std::strtoul(argv[++i], nullptr, 10);
+		} else if (!what) {
+			what = argv[i];
+		} else {
+			file = argv[i];
+		}
+	}
+	if (!what || (std::strcmp(what, "lexer") && std::strcmp(what, "parser") && std::strcmp(what, "exec")) ||
+	    !file || rounds == 0) {
+		std::cerr << "Usage: " << argv[0] << " --bench (lexer | parser | exec) [-n rounds] file" << std::endl;
+		return 2;
+	}
+	bool parser = !std::strcmp(what, "parser");
+
+	std::vector<ProgramString> blocks;
+	FileHandler fh(file, nullptr);     //текст файла нужен индексу строк до конца замера
+	if (!fh.good()) return 1;
+	Position::lines.reset(fh.text());
+	for (ProgramString ps = fh.next(); !ps.program.empty(); ps = fh.next()) {
+		blocks.push_back(ps);
+	}
+	size_t bytes = 0;
+	for (auto& ps : blocks) bytes += ps.length;
+	if (!std::strcmp(what, "exec")) {
+		return bench_exec(file, blocks, bytes, rounds);
+	}
+
+	size_t tokens = 0;
+	uint64_t hash = 14695981039346656037ULL;
+	auto mix = [&hash](const void *p, size_t n) {
+		fnv_mix(hash, p, n);
+	};
+	Arena arena;
+	bool ok = run_reported(file, [&]() {
+		for (auto& ps : blocks) {
+			if (parser) {           //отпечаток: дерево в формате кэша
+				std::string saved;
+				parse_block(ps, arena)->save(saved);
+				arena.reset();
+				Node::reps.clear();
+				mix(saved.data(), saved.size());
+				continue;
+			}
+			Lexer l;                //отпечаток: тег, текст и координаты каждого токена
+			for (auto& t : l.program_to_tokens(ps)) {
+				mix(&t._tag, sizeof(t._tag));
+				Coordinate begin = Position::lines.coordinate(t.at());
+				Coordinate end = Position::lines.coordinate(ps.offset + t.end());
+				mix(t.raw().data(), t.raw().size());
+				mix(&begin, sizeof(begin));
+				mix(&end, sizeof(end));
+			}
+		}
+	});
+	if (!ok) return 1;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < rounds; ++r) {
+		for (auto& ps : blocks) {
+			if (parser) {
+				parse_block(ps, arena);
+				arena.reset();
+				Node::reps.clear();
+				continue;
+			}
+			Lexer l;
+			l.start(ps);
+			while (l.pull()._tag != NONE) ++tokens;
+			++tokens;               //NONE
+		}
+	}
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << blocks.size() << " blocks, " << bytes << " bytes, ";
+	if (!parser) {
+		std::cout << tokens / rounds << " tokens (" << sizeof(Token) << " B each); "
+		          << tokens / s / 1e6 << " Mtokens/s, ";
+	}
+	std::cout << bytes * rounds / s / 1e6 << " MB/s; "
+	          << "fingerprint " << std::hex << hash << std::dec << std::endl;
+	return 0;
 }
 
 int main(int argc, char *argv[]) {
-    auto start = std::chrono::steady_clock::now();
+	if (!open_cache(argc, argv)) {
+		return 2;
+	}
+	if (argc > 1 && !std::strcmp(argv[1], "--batch")) {
+		return run_batch(argc, argv);
+	}
+	if (argc > 1 && !std::strcmp(argv[1], "--follow-includes")) {
+		return run_document(argc, argv);
+	}
+	if (argc > 1 && !std::strcmp(argv[1], "--watch")) {
+		return run_watch(argc, argv);
+	}
+	if (argc > 1 && !std::strcmp(argv[1], "--pipeline")) {
+		return run_pipeline(argc, argv);
+	}
+	if (argc > 1 && !std::strcmp(argv[1], "--stream")) {
+		return run_stream(argc, argv);
+	}
+	if (argc > 1 && !std::strcmp(argv[1], "--serve")) {
+		return run_serve(argc, argv);
+	}
+	if (argc > 1 && !std::strcmp(argv[1], "--bench")) {
+		return run_bench(argc, argv);
+	}
 
-    Parser B;
+    auto start = std::chrono::steady_clock::now();
 
-	bool ok = true;
 	bool replace = false;   //файл не будет перезаписан по-умолчанию
 
-	const char *file_in;
-	const char *file_out;
+	std::string file_in;
+	std::string file_out;
 
 	if (argc < 2 || argc > 3) { //число аргументов должно быть равно 1 или 2
 		file_in = "test.tex";
@@ -55,10 +495,12 @@ int main(int argc, char *argv[]) {
 //		return 1;
 	} else {
 		file_in = argv[1];
-		if (argc == 2 || !std::strcmp(file_in, argv[2])) { //если указан один аргумент или 1 и 2 аргументы совпадают
-			file_out = new char[std::strlen(file_in) + 2];        //то файл будет перезаписан
-			std::strcpy(const_cast<char *>(file_out), "_");
-			std::strcat(const_cast<char *>(file_out), file_in);
+		if (file_in == "-" && (argc == 2 || !std::strcmp(argv[2], "-"))) {    //фильтр: stdin -> stdout
+			file_out = "-";
+		} else if (argc == 3 && !std::strcmp(argv[2], "-")) {
+			file_out = "-";
+		} else if (argc == 2 || file_in == argv[2]) { //если указан один аргумент или 1 и 2 аргументы совпадают
+			file_out = temp_name(file_in);     //то файл будет перезаписан
 			replace = true;
 		}
 		else {
@@ -69,81 +511,17 @@ int main(int argc, char *argv[]) {
 //	std::cout << file_in;
 //	std::cout << file_out;
 
-	FileHandler &fh = FileHandler::Instance(file_in, file_out);
-	if (!fh.good()) {
-		std::cerr << file_in << ":" << "Failed to initialize" << std::endl;
-		ok = false;
-	}
-
-	Node *res;
-	while (ok) {
-		Position::ps = fh.next();
-        if (Position::ps.program.empty()) {
-            break;
-        }
-		Lexer l;
-		try {
-			std::vector<Token> p = l.program_to_tokens(Position::ps);
-//			for (auto& i : p) {
-//                printf("%s\n", to_string(i).c_str());
-//            }
-			B.init(p);
-//            std::cout << "after B.init(p);\n";
-			res = new Node();
-//            std::cout << "after res = new Node();\n";
-			res->fields = B.block(NONE);
-//            std::cout << "after B.block(NONE);\n";
-			res->set_tag(ROOT);
-//			res->print("");
-//            std::cout << "after res->print(\"\");\n";
-
-            // Стадия семантического анализа для проверки корректности операций с размерными физическими величинами
-            res->semantic_analysis();
-
-			res->exec({});
-//			std::cout << "after exec()\n";
-
-			//std::string replacement = Position::ps.program;
-			std::string replacement = make_replacement(Position::ps.program, Node::reps);
-//			std::cout << "after replacement\n";
-			fh.print_to_out(replacement);
-//			std::cout << "fh.print_to_out\n";
-			Node::reps.clear();
-		}
-		catch (Error& err) {
-		    std::cout << "catch (Error err)\n";
-			std::cerr << file_in << ":" << err.what() << std::endl;
-			ok = false;
-		}
-		catch (Value::BadType& err) {
-            std::cout << "catch (Value::BadType err\n)";
-			std::cerr << file_in << ":" << err.what() << std::endl;
-			ok = false;
-		}
-		catch (std::exception& err) {
-            std::cout << "catch (std::exception err)\n";
-			std::cerr << file_in << ":" << err.what() << std::endl;
-			ok = false;
-		}
-
-        delete res;
+	bool to_stdout = file_out == "-";
+	if (to_stdout) {                //в stdout идет только результат, остальное - в stderr
+		FileHandler::redirect_stdout();
 	}
 
-	if (ok) {                   //если удалось обработать файл и
-		if (replace) {          //если надо перезаписать файл
-			fh.replace_files();
-		}
-	} else { //если не удалось обработать файл, то удалить выходной файл
-		fh.remove_out();
-	}
-
-//	if (replace) {
-//	    delete[] file_out;
-//	}
+	bool ok = process_file(file_in.c_str(), file_out.c_str(), replace, cache.get());
 
     auto end = std::chrono::steady_clock::now();
     auto diff = end - start;
     std::cout << std::chrono::duration <double, std::milli> (diff).count() << std::endl;
+    report_cache();
 
-    return 0;
-}
\ No newline at end of file
+    return ok ? 0 : 1;
+}